@@ -6,14 +6,145 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <initializer_list>
+#include <limits>
+#include <new>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined(ESP_PLATFORM)
+  #include <esp_heap_caps.h>
+  #include <esp_idf_version.h>
+  #include <esp_partition.h>
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/semphr.h>
+  #include <freertos/task.h>
+  #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    #include <esp_cpu.h>
+  #else
+    #include <hal/cpu_hal.h>
+  #endif
+#else
+  #include <chrono>
+#endif
+
+#if defined(__cpp_impl_coroutine)
+  #include <coroutine>
+  #include <exception>
+#endif
+
+#if defined(__SSSE3__)
+  #include <tmmintrin.h>
+  #define STATEFORGE_SIMD_GATHER 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  #include <arm_neon.h>
+  #define STATEFORGE_SIMD_GATHER 1
+#else
+  #define STATEFORGE_SIMD_GATHER 0
+#endif
+
 namespace StateForge {
 
-enum class TranResult { Change, NoChange, Reset, NotFound, InvalidContext };
+/**
+ * Deferred: dispatch() was called from inside a hook of the same machine, the event was queued and
+ * will run after the current transition completes.
+ * Overflow: same as Deferred, but the run-to-completion queue was full and the event was dropped.
+ * Pending: the coroutine on_transition hook of an AsyncStateMachine suspended, the transition
+ * completes when it resumes.
+ */
+enum class TranResult {
+  Change,
+  NoChange,
+  Reset,
+  NotFound,
+  InvalidContext,
+  Deferred,
+  Overflow,
+  Pending
+};
+
+// Set of TranResult values, e.g. TranResult::NotFound | TranResult::InvalidContext
+class ResultMask {
+  public:
+  constexpr ResultMask()
+      : _bits(0) {}
+
+  constexpr ResultMask(TranResult result)
+      : _bits(1u << static_cast<uint32_t>(result)) {}
+
+  constexpr ResultMask operator|(ResultMask other) const { return ResultMask(_bits | other._bits); }
+  constexpr bool has(TranResult result) const {
+    return (_bits & (1u << static_cast<uint32_t>(result))) != 0;
+  }
+
+  private:
+  explicit constexpr ResultMask(uint32_t bits)
+      : _bits(bits) {}
+
+  uint32_t _bits;
+};
+
+constexpr ResultMask operator|(TranResult a, TranResult b) { return ResultMask(a) | b; }
+
+// Outcome of a batch dispatch: events consumed, and the result of the last one
+struct BatchResult {
+  size_t processed;
+  TranResult result;
+};
+
+// Outcome of a broadcast: instances that had a transition, and Change when it ran, or Deferred or
+// Overflow when it was called from a hook and queued or dropped, matching nothing either way
+struct BroadcastResult {
+  size_t matched;
+  TranResult result;
+};
+
+/**
+ * Problems found when validating a transition table, in the order they are looked for:
+ * - Overflow: more transitions than the storage (see InlineStorage) or the lookup index can hold;
+ *   entry is the first one that was dropped.
+ * - OutOfRange: a state past the state count of the definition, or any state value of 64 or more,
+ *   as reachability is tracked in a 64 bit mask.
+ * - Duplicate: a (from, event) pair declared again after an unguarded entry, so it never fires.
+ * - DeadState: a transition from a state that cannot be reached from the initial state.
+ * - Shadowed: a wildcard transition that never fires, because every reachable state has an
+ *   unguarded transition for its event that takes precedence.
+ */
+enum class TableIssue : uint8_t { None, OutOfRange, Duplicate, DeadState, Shadowed, Overflow };
+
+// First problem of a table and the index of its transition, SIZE_MAX for the initial state
+struct TableCheck {
+  TableIssue issue;
+  size_t entry;
+};
+
+// Events a hook can dispatch to its own machine while a transition is running
+#ifndef STATEFORGE_RTC_QUEUE_SIZE
+  #define STATEFORGE_RTC_QUEUE_SIZE 4
+#endif
+
+// Bytes each of those events has to hold a copy of its payload
+#ifndef STATEFORGE_RTC_PAYLOAD_SIZE
+  #define STATEFORGE_RTC_PAYLOAD_SIZE 16
+#endif
+
+// Maximum nesting levels of a HierarchicalStateMachine, counting top-level states
+#ifndef STATEFORGE_MAX_DEPTH
+  #define STATEFORGE_MAX_DEPTH 4
+#endif
+
+// Guards are noexcept wherever the language lets a function pointer type say so (C++17)
+#if defined(__cpp_noexcept_function_type)
+  #define STATEFORGE_GUARD_NOEXCEPT noexcept
+#else
+  #define STATEFORGE_GUARD_NOEXCEPT
+#endif
 
 class Context {
   public:
@@ -43,97 +174,4962 @@ class Context {
   size_t derived_type;
 };
 
-template <typename StateType, typename EventType>
+/**
+ * Wildcard for the from and/or event fields of a transition, e.g. {any<States>(), Events::Fault,
+ * States::Error, ...}. Lookups prefer an exact (from, event) match, then (from, any event), then
+ * (any state, event), then (any state, any event). Hooks of a wildcard transition receive the
+ * actual current state and event. Wildcard sources never provide enter hooks.
+ */
+template <typename Enum>
+constexpr Enum any() {
+  return static_cast<Enum>(std::numeric_limits<typename std::underlying_type<Enum>::type>::max());
+}
+
+namespace detail {
+template <typename Enum>
+constexpr bool isAny(Enum value) {
+  return value == any<Enum>();
+}
+} // namespace detail
+
+/**
+ * Non-owning callable: a target pointer plus a call stub, two pointers wide, never allocates.
+ * Accepts function pointers and captureless lambdas implicitly; member functions and functors are
+ * bound with bind(), and the bound object must outlive the delegate.
+ */
+template <typename Signature>
+class Delegate;
+
+template <typename Return, typename... Args>
+class Delegate<Return(Args...)> {
+  public:
+  using Function = Return (*)(Args...);
+
+  constexpr Delegate()
+      : _stub(nullptr)
+      , _object(nullptr) {}
+
+  constexpr Delegate(std::nullptr_t)
+      : Delegate() {}
+
+  constexpr Delegate(Function function)
+      : _stub(function ? &callFunction : nullptr)
+      , _function(function) {}
+
+  // Captureless lambdas
+  template <typename Callable,
+    typename = typename std::enable_if<std::is_convertible<Callable, Function>::value &&
+                                       !std::is_same<Callable, Function>::value>::type>
+  constexpr Delegate(Callable callable)
+      : Delegate(static_cast<Function>(callable)) {}
+
+  // Function known at compile time: the stub calls it directly
+  template <Return (*Target)(Args...)>
+  static Delegate bind() {
+    return Delegate(&callTarget<Target>, nullptr);
+  }
+
+  template <typename Type, Return (Type::*Method)(Args...)>
+  static Delegate bind(Type* object) {
+    return Delegate(&callMethod<Type, Method>, object);
+  }
+
+  template <typename Type, Return (Type::*Method)(Args...) const>
+  static Delegate bind(const Type* object) {
+    return Delegate(&callConstMethod<Type, Method>, const_cast<Type*>(object));
+  }
+
+  template <typename Callable>
+  static Delegate bind(Callable* callable) {
+    return Delegate(&callCallable<Callable>, callable);
+  }
+
+  explicit operator bool() const { return _stub != nullptr; }
+
+  Return operator()(Args... args) const { return _stub(*this, std::forward<Args>(args)...); }
+
+  private:
+  using Stub = Return (*)(const Delegate& self, Args... args);
+
+  Delegate(Stub stub, void* object)
+      : _stub(stub)
+      , _object(object) {}
+
+  static Return callFunction(const Delegate& self, Args... args) {
+    return self._function(std::forward<Args>(args)...);
+  }
+
+  template <Return (*Target)(Args...)>
+  static Return callTarget(const Delegate&, Args... args) {
+    return Target(std::forward<Args>(args)...);
+  }
+
+  template <typename Type, Return (Type::*Method)(Args...)>
+  static Return callMethod(const Delegate& self, Args... args) {
+    return (static_cast<Type*>(self._object)->*Method)(std::forward<Args>(args)...);
+  }
+
+  template <typename Type, Return (Type::*Method)(Args...) const>
+  static Return callConstMethod(const Delegate& self, Args... args) {
+    return (static_cast<const Type*>(self._object)->*Method)(std::forward<Args>(args)...);
+  }
+
+  template <typename Callable>
+  static Return callCallable(const Delegate& self, Args... args) {
+    return (*static_cast<Callable*>(self._object))(std::forward<Args>(args)...);
+  }
+
+  Stub _stub;
+  union {
+    void* _object;
+    Function _function;
+  };
+};
+
+/**
+ * Hook is the callable wrapper used for on_enter, on_transition and on_exit: std::function by
+ * default, or Delegate for two-pointer, allocation-free hooks.
+ *
+ * ContextType is the type hooks receive their context as. The default is the tagged Context base,
+ * checked at run time with is<>(); any other type, which needs no base class, vtable or tag, is
+ * checked at compile time instead.
+ *
+ * guard is an optional plain function that must not throw. Transitions sharing a (from, event) pair
+ * are tried in declaration order and the first one without a guard, or whose guard returns true,
+ * runs; when every guard rejects, dispatch returns NoChange without calling any hook.
+ *
+ * after, when not 0, makes the transition timed: its event is also dispatched by itself once from
+ * has been the current state for after ticks of a TimerWheel (see MachineTimer). Only the first
+ * timed transition of each state is used, and from and event can not be wildcards.
+ *
+ * Both are defaulted by the constructor, so tables listing only the first seven fields still build
+ * without missing initializer warnings.
+ */
+template <typename StateType, typename EventType, template <typename> class Hook = std::function,
+  typename ContextType = Context>
 struct Transition {
+  using EnterHook =
+    Hook<void(StateType from, EventType event, StateType to, ContextType* const context)>;
+  using TransitionHook =
+    Hook<TranResult(StateType from, EventType event, StateType to, ContextType* const context)>;
+  using ExitHook = EnterHook;
+  using Guard    = bool (*)(StateType from, EventType event, StateType to,
+    ContextType* const context) STATEFORGE_GUARD_NOEXCEPT;
+
+  Transition(StateType from, EventType event, StateType to, EnterHook on_enter,
+    TransitionHook on_transition, ExitHook on_exit, ContextType* const context,
+    Guard guard = nullptr, uint32_t after = 0)
+      : from(from)
+      , event(event)
+      , to(to)
+      , on_enter(std::move(on_enter))
+      , on_transition(std::move(on_transition))
+      , on_exit(std::move(on_exit))
+      , context(context)
+      , guard(guard)
+      , after(after) {}
+
   StateType from;
   EventType event;
   StateType to;
 
-  std::function<void(StateType from, EventType event, StateType to, Context* const context)>
-    on_enter;
-  std::function<TranResult(StateType from, EventType event, StateType to, Context* const context)>
+  Hook<void(StateType from, EventType event, StateType to, ContextType* const context)> on_enter;
+  Hook<TranResult(StateType from, EventType event, StateType to, ContextType* const context)>
     on_transition;
-  std::function<void(StateType from, EventType event, StateType to, Context* const context)>
-    on_exit;
+  Hook<void(StateType from, EventType event, StateType to, ContextType* const context)> on_exit;
 
-  Context* const context;
+  ContextType* const context;
+  Guard guard;
+  uint32_t after;
 };
 
-template <typename StateType, typename EventType>
-class StateMachine {
-  static_assert(std::is_enum<StateType>::value, "StateType must be an enum class!");
-  static_assert(std::is_enum<EventType>::value, "EventType must be an enum class!");
+/**
+ * Enter and exit hooks of a single state, run by every transition that enters or leaves it. They
+ * are passed to a machine as an array indexed by state value: entry i must describe state i, and
+ * entries that do not are ignored. When a machine has descriptors, the on_enter hooks of its
+ * transitions are not used.
+ */
+template <typename StateType, typename EventType, template <typename> class Hook = std::function,
+  typename ContextType = Context>
+struct StateDescriptor {
+  StateType state;
 
-  public:
-  StateMachine(StateType initial_state,
-    std::initializer_list<Transition<StateType, EventType>> transitions)
-      : _initial_state(initial_state)
-      , _current_state(initial_state)
-      , _transitions(transitions) {}
+  Hook<void(StateType from, EventType event, StateType to, ContextType* const context)> on_enter;
+  Hook<void(StateType from, EventType event, StateType to, ContextType* const context)> on_exit;
 
-  ~StateMachine()                              = default;
-  StateMachine(const StateMachine&)            = delete;
-  StateMachine& operator=(const StateMachine&) = delete;
-  StateMachine(StateMachine&&)                 = delete;
-  StateMachine& operator=(StateMachine&&)      = delete;
+  ContextType* const context;
+};
 
-  TranResult dispatch(EventType event) {
-    for (const auto& transition : _transitions) {
-      if (transition.from == _current_state && transition.event == event) {
-        TranResult result = TranResult::Change;
-
-        if (transition.on_transition)
-          result = transition.on_transition(transition.from,
-            transition.event,
-            transition.to,
-            transition.context);
-
-        if (transition.on_exit)
-          transition.on_exit(transition.from, transition.event, transition.to, transition.context);
-
-        // If the transition result is Reset, it will execute the on_enter hook of the initial state
-        // Else, it will execute the on_enter hook of the next state
-        StateType next_state = result == TranResult::Reset ? _initial_state : transition.to;
-
-        for (const auto& next_transition : _transitions) {
-          if ((next_transition.from == next_state) && next_transition.on_enter) {
-            next_transition.on_enter(transition.from,
-              transition.event,
-              transition.to,
-              next_transition.context);
-
-            break;
-          }
-        }
+namespace detail {
+// Returned by the lookup policies when no transition matches
+constexpr size_t kNoTransition = static_cast<size_t>(-1);
 
-        switch (result) {
-          case TranResult::Change: _current_state = transition.to; return result;
-          case TranResult::Reset: _current_state = _initial_state; return result;
-          default: return result;
-        }
-      }
+constexpr size_t firstOf(size_t a, size_t b) { return a != kNoTransition ? a : b; }
+
+template <typename Entry>
+constexpr bool sameKey(const Entry& a, const Entry& b) {
+  return (a.from == b.from) && (a.event == b.event);
+}
+
+// Bit of state in a 64 bit mask, 0 for wildcards and values past the mask
+template <typename StateType>
+constexpr uint64_t bitOf(StateType state) {
+  return (isAny(state) || (static_cast<size_t>(state) >= 64))
+           ? 0
+           : uint64_t(1) << static_cast<size_t>(state);
+}
+
+/**
+ * Validates a runtime transition table, see TableIssue. lineage(state) is the mask of state and its
+ * ancestors, and state_count bounds the states when it is not 0.
+ */
+template <typename Table, typename StateType, typename Lineage>
+TableCheck checkTable(const Table& transitions, StateType initial, size_t state_count,
+  Lineage lineage) {
+  const size_t count = transitions.size();
+  const size_t limit = ((state_count == 0) || (state_count > 64)) ? 64 : state_count;
+  if (static_cast<size_t>(initial) >= limit) return {TableIssue::OutOfRange, kNoTransition};
+
+  for (size_t i = 0; i < count; i++) {
+    const auto& transition = transitions[i];
+    if ((!isAny(transition.from) && (static_cast<size_t>(transition.from) >= limit)) ||
+        (static_cast<size_t>(transition.to) >= limit))
+      return {TableIssue::OutOfRange, i};
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < i; j++) {
+      if (!transitions[j].guard && sameKey(transitions[j], transitions[i]))
+        return {TableIssue::Duplicate, i};
+    }
+  }
+
+  uint64_t reached = bitOf(initial);
+  uint64_t active  = lineage(initial);
+
+  // A wildcard fires from a reached state when neither it nor its ancestors have an unguarded
+  // (state, event) or (state, any) entry, which both take precedence
+  const auto fires = [&](decltype(transitions[0]) wildcard) -> bool {
+    uint64_t covered = 0;
+    for (size_t i = 0; i < count; i++) {
+      const auto& other = transitions[i];
+      const bool event  = isAny(other.event) || (other.event == wildcard.event);
+      if (!isAny(other.from) && !other.guard && event) covered |= bitOf(other.from);
+    }
+
+    for (size_t state = 0; state < limit; state++) {
+      const StateType value = static_cast<StateType>(state);
+      if ((reached & bitOf(value)) && !(lineage(value) & covered)) return true;
     }
 
-    return TranResult::NotFound;
+    return false;
+  };
+
+  // Other transitions fire from any active state: the reached ones and their ancestors
+  for (bool grown = true; grown;) {
+    grown = false;
+    for (size_t i = 0; i < count; i++) {
+      const auto& transition = transitions[i];
+      const uint64_t target  = bitOf(transition.to);
+      if (reached & target) continue;
+      if (isAny(transition.from) ? !fires(transition) : !(active & bitOf(transition.from)))
+        continue;
+
+      reached |= target;
+      active |= lineage(transition.to);
+      grown = true;
+    }
   }
 
-  StateType getCurrentState() { return _current_state; }
-  void resetState() { _current_state = _initial_state; }
+  for (size_t i = 0; i < count; i++) {
+    if (!isAny(transitions[i].from) && !(active & bitOf(transitions[i].from)))
+      return {TableIssue::DeadState, i};
+  }
 
-  Context* const getContext(StateType from, EventType event, StateType to) const {
-    for (const auto& transition : _transitions) {
-      if ((transition.from == from) && (transition.event == event) && (transition.to == to)) {
-        return transition.context;
+  for (size_t i = 0; i < count; i++) {
+    if (isAny(transitions[i].from) && !fires(transitions[i])) return {TableIssue::Shadowed, i};
+  }
+
+  return {TableIssue::None, kNoTransition};
+}
+
+// Entry of the descriptor array for state, or nullptr when there is none
+template <typename Table, typename StateType>
+auto descriptorOf(const Table& states, StateType state) -> decltype(&states[0]) {
+  const size_t index = static_cast<size_t>(state);
+  if ((index >= states.size()) || (states[index].state != state)) return nullptr;
+
+  return &states[index];
+}
+
+// Key of entry i of a table, read on its own when the table decodes entries on access (see
+// BinaryTable), so scans only decode the entries that match
+template <typename Table>
+auto fromOf(const Table& transitions, size_t i, int) -> decltype(transitions.fromAt(i)) {
+  return transitions.fromAt(i);
+}
+
+template <typename Table>
+auto fromOf(const Table& transitions, size_t i, long) -> decltype(transitions[i].from) {
+  return transitions[i].from;
+}
+
+template <typename Table>
+auto eventOf(const Table& transitions, size_t i, int) -> decltype(transitions.eventAt(i)) {
+  return transitions.eventAt(i);
+}
+
+template <typename Table>
+auto eventOf(const Table& transitions, size_t i, long) -> decltype(transitions[i].event) {
+  return transitions[i].event;
+}
+
+// First transition from match on with the same (from, event) pair whose guard passes, skipping
+// targets past state_count. Only scans further when a guard rejects.
+template <typename Table, typename StateType, typename EventType>
+size_t firstEnabled(const Table& transitions, size_t match, StateType state, EventType event,
+  size_t state_count = kNoTransition) {
+  const auto from = fromOf(transitions, match, 0);
+  const auto key  = eventOf(transitions, match, 0);
+
+  for (size_t i = match; i < transitions.size(); i++) {
+    if ((fromOf(transitions, i, 0) != from) || (eventOf(transitions, i, 0) != key)) continue;
+
+    const auto& transition = transitions[i];
+    if (static_cast<size_t>(transition.to) >= state_count) continue;
+
+    if (!transition.guard || transition.guard(state, event, transition.to, transition.context))
+      return i;
+  }
+
+  return kNoTransition;
+}
+
+// Fills the empty slots of a dense [state][event] table with the wildcard entries of transitions,
+// keeping the first match of each kind. fillAnyEvent() handles (from, any event);
+// fillAnyState() handles (any state, event) and then (any state, any event). Empty slots hold the
+// maximum of Slot.
+template <typename Table, typename Slot>
+void fillAnyEvent(const Table& transitions, Slot* slots, size_t state_count, size_t event_count) {
+  const Slot empty = std::numeric_limits<Slot>::max();
+
+  for (size_t state = 0; state < state_count; state++) {
+    for (size_t i = 0; (i < transitions.size()) && (i < empty); i++) {
+      const auto& transition = transitions[i];
+      if ((static_cast<size_t>(transition.from) != state) || !isAny(transition.event)) continue;
+
+      for (size_t event = 0; event < event_count; event++) {
+        Slot& slot = slots[state * event_count + event];
+        if (slot == empty) slot = static_cast<Slot>(i);
       }
+
+      break;
     }
+  }
+}
 
-    return nullptr;
+template <typename Table, typename Slot>
+void fillAnyState(const Table& transitions, Slot* slots, size_t state_count, size_t event_count) {
+  const Slot empty = std::numeric_limits<Slot>::max();
+
+  for (size_t i = 0; (i < transitions.size()) && (i < empty); i++) {
+    const auto& transition = transitions[i];
+    const size_t event     = static_cast<size_t>(transition.event);
+    if (!isAny(transition.from) || (event >= event_count)) continue;
+
+    for (size_t state = 0; state < state_count; state++) {
+      Slot& slot = slots[state * event_count + event];
+      if (slot == empty) slot = static_cast<Slot>(i);
+    }
+  }
+
+  for (size_t i = 0; (i < transitions.size()) && (i < empty); i++) {
+    if (!isAny(transitions[i].from) || !isAny(transitions[i].event)) continue;
+
+    for (size_t slot = 0; slot < state_count * event_count; slot++) {
+      if (slots[slot] == empty) slots[slot] = static_cast<Slot>(i);
+    }
+
+    break;
+  }
+}
+
+// Fixed-capacity array constructed in place, entries past Capacity are dropped and counted
+template <typename Type, size_t Capacity>
+class InlineArray {
+  static_assert(Capacity > 0, "Capacity must be greater than 0!");
+
+  public:
+  InlineArray(std::initializer_list<Type> items)
+      : InlineArray(items.begin(), items.end()) {}
+
+  InlineArray(const Type* first, const Type* last)
+      : _size(0) {
+    for (; (first != last) && (_size < Capacity); ++first, ++_size)
+      new (&data()[_size]) Type(*first);
+
+    _dropped = static_cast<size_t>(last - first);
+  }
+
+  ~InlineArray() {
+    for (size_t i = 0; i < _size; i++)
+      data()[i].~Type();
   }
 
+  InlineArray(const InlineArray&)            = delete;
+  InlineArray& operator=(const InlineArray&) = delete;
+
+  size_t size() const { return _size; }
+  size_t dropped() const { return _dropped; }
+  const Type& operator[](size_t index) const { return data()[index]; }
+  const Type* begin() const { return data(); }
+  const Type* end() const { return data() + _size; }
+
   private:
-  StateType _initial_state;
+  Type* data() { return reinterpret_cast<Type*>(_storage); }
+  const Type* data() const { return reinterpret_cast<const Type*>(_storage); }
+
+  alignas(Type) unsigned char _storage[sizeof(Type) * Capacity];
+  size_t _size;
+  size_t _dropped;
+};
+
+// Entries a container could not hold, only InlineArray drops any
+template <typename Container>
+auto droppedOf(const Container& container, int) -> decltype(container.dropped()) {
+  return container.dropped();
+}
+
+template <typename Container>
+size_t droppedOf(const Container&, long) {
+  return 0;
+}
+
+// First transition dropped by the storage or past the capacity of the index, or kNoTransition
+template <typename Table>
+size_t firstDropped(const Table& transitions, size_t capacity) {
+  if (droppedOf(transitions, 0) > 0) return transitions.size();
+  return transitions.size() > capacity ? capacity : kNoTransition;
+}
+
+// Unique address per type, to check a payload against the type it is read as
+template <typename Type>
+struct TypeTag {
+  static const char id;
+};
+
+template <typename Type>
+const char TypeTag<Type>::id = 0;
+
+// Type-checked reference to the payload of an event, empty for plain events
+struct PayloadRef {
+  const void* data;
+  const void* type;
+
+  template <typename Payload>
+  static PayloadRef of(const Payload& payload) {
+    return {&payload, &TypeTag<Payload>::id};
+  }
+
+  template <typename Payload>
+  const Payload* get() const {
+    return type == &TypeTag<Payload>::id ? static_cast<const Payload*>(data) : nullptr;
+  }
+};
+
+// Only payloads that can be copied as bytes into the storage of a DeferredEvent fit
+template <typename Payload>
+struct FitsDeferred
+    : std::integral_constant<bool,
+        std::is_trivially_copyable<Payload>::value &&
+          (sizeof(Payload) <= STATEFORGE_RTC_PAYLOAD_SIZE) &&
+          (alignof(Payload) <= alignof(std::max_align_t))> {};
+
+// Event dispatched from a hook, with a copy of its payload in fixed storage
+template <typename EventType>
+struct DeferredEvent {
+  static_assert(STATEFORGE_RTC_PAYLOAD_SIZE > 0, "STATEFORGE_RTC_PAYLOAD_SIZE must be at least 1!");
+
+  EventType event;
+  const void* type;
+  alignas(std::max_align_t) unsigned char data[STATEFORGE_RTC_PAYLOAD_SIZE];
+
+  static DeferredEvent of(EventType event) {
+    DeferredEvent deferred;
+    deferred.event = event;
+    deferred.type  = nullptr;
+    return deferred;
+  }
+
+  template <typename Payload>
+  static DeferredEvent of(EventType event, const Payload& payload) {
+    DeferredEvent deferred;
+    deferred.event = event;
+    deferred.type  = &TypeTag<Payload>::id;
+    std::memcpy(deferred.data, &payload, sizeof(Payload));
+    return deferred;
+  }
+
+  PayloadRef payload() const { return {data, type}; }
+};
+
+// Run-to-completion bookkeeping: marks a machine as busy while a transition runs and holds the
+// events dispatched re-entrantly meanwhile
+template <typename EventType, size_t Capacity>
+class RunToCompletion {
+  static_assert((Capacity > 0) && (Capacity <= UINT8_MAX),
+    "STATEFORGE_RTC_QUEUE_SIZE must be between 1 and 255!");
+
+  public:
+  constexpr RunToCompletion()
+      : _events()
+      , _head(0)
+      , _count(0)
+      , _busy(false) {}
+
+  bool isBusy() const { return _busy; }
+  void setBusy(bool busy) { _busy = busy; }
+
+  bool push(const EventType& event) {
+    if (_count == Capacity) return false;
+
+    _events[(_head + _count) % Capacity] = event;
+    _count++;
+    return true;
+  }
+
+  bool pop(EventType& event) {
+    if (_count == 0) return false;
+
+    event = _events[_head];
+    _head = static_cast<uint8_t>((_head + 1) % Capacity);
+    _count--;
+    return true;
+  }
+
+  private:
+  EventType _events[Capacity];
+  uint8_t _head;
+  uint8_t _count;
+  bool _busy;
+};
+
+// Non-owning view over a caller-supplied array
+template <typename Type>
+class BufferView {
+  public:
+  BufferView(std::initializer_list<Type> items) = delete;
+
+  BufferView(const Type* first, const Type* last)
+      : _first(first)
+      , _size(static_cast<size_t>(last - first)) {}
+
+  size_t size() const { return _size; }
+  const Type& operator[](size_t index) const { return _first[index]; }
+  const Type* begin() const { return _first; }
+  const Type* end() const { return _first + _size; }
+
+  private:
+  const Type* _first;
+  size_t _size;
+};
+} // namespace detail
+
+/**
+ * Storage policies for the transition table of a StateMachine.
+ * - HeapStorage: std::vector, the default.
+ * - InlineStorage<N>: up to N transitions stored inside the machine, no allocation; validate()
+ *   reports any past N as Overflow.
+ * - BufferStorage: points to a caller-supplied array that must outlive the machine.
+ * - AllocatorStorage<A>: std::vector with a custom allocator, e.g. PsramStorage on ESP32.
+ */
+struct HeapStorage {
+  template <typename Type>
+  using Container = std::vector<Type>;
+};
+
+template <size_t Capacity>
+struct InlineStorage {
+  template <typename Type>
+  using Container = detail::InlineArray<Type, Capacity>;
+};
+
+struct BufferStorage {
+  template <typename Type>
+  using Container = detail::BufferView<Type>;
+};
+
+template <template <typename> class Allocator>
+struct AllocatorStorage {
+  template <typename Type>
+  using Container = std::vector<Type, Allocator<Type>>;
+};
+
+#if defined(ESP_PLATFORM)
+// Allocates from PSRAM, falling back to internal RAM when there is none left
+template <typename Type>
+struct PsramAllocator {
+  using value_type = Type;
+
+  PsramAllocator() = default;
+
+  template <typename Other>
+  PsramAllocator(const PsramAllocator<Other>&) {}
+
+  Type* allocate(size_t count) {
+    return static_cast<Type*>(heap_caps_malloc_prefer(sizeof(Type) * count,
+      2,
+      MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+      MALLOC_CAP_DEFAULT));
+  }
+
+  void deallocate(Type* pointer, size_t) { heap_caps_free(pointer); }
+
+  template <typename Other>
+  bool operator==(const PsramAllocator<Other>&) const {
+    return true;
+  }
+
+  template <typename Other>
+  bool operator!=(const PsramAllocator<Other>&) const {
+    return false;
+  }
+};
+
+using PsramStorage = AllocatorStorage<PsramAllocator>;
+#endif
+
+namespace detail {
+// Smallest unsigned type that holds Max
+template <size_t Max>
+using UintFor = typename std::conditional<(Max <= UINT8_MAX), uint8_t,
+  typename std::conditional<(Max <= UINT16_MAX), uint16_t, uint32_t>::type>::type;
+} // namespace detail
+
+/**
+ * Default lookup policy: scans the transition table in declaration order on every dispatch.
+ */
+struct LinearIndex {
+  template <typename Table>
+  void build(const Table&) {}
+
+  // Transitions the index can look up, validate() reports the ones past it as Overflow
+  size_t getCapacity() const { return SIZE_MAX; }
+
+  template <typename Table, typename StateType, typename EventType>
+  size_t find(const Table& transitions, StateType state, EventType event) const {
+    size_t any_event = detail::kNoTransition;
+    size_t any_state = detail::kNoTransition;
+    size_t any_both  = detail::kNoTransition;
+
+    for (size_t i = 0; i < transitions.size(); i++) {
+      const auto from = detail::fromOf(transitions, i, 0);
+      const auto key  = detail::eventOf(transitions, i, 0);
+
+      if (from == state) {
+        if (key == event) return i;
+        if (detail::isAny(key) && (any_event == detail::kNoTransition)) any_event = i;
+      } else if (detail::isAny(from)) {
+        if ((key == event) && (any_state == detail::kNoTransition)) any_state = i;
+        if (detail::isAny(key) && (any_both == detail::kNoTransition)) any_both = i;
+      }
+    }
+
+    return detail::firstOf(any_event, detail::firstOf(any_state, any_both));
+  }
+
+  template <typename Table, typename StateType>
+  size_t findEnter(const Table& transitions, StateType state) const {
+    for (size_t i = 0; i < transitions.size(); i++) {
+      if ((detail::fromOf(transitions, i, 0) == state) && transitions[i].on_enter) return i;
+    }
+
+    return detail::kNoTransition;
+  }
+
+  template <typename Table, typename StateType>
+  size_t findTimed(const Table& transitions, StateType state) const {
+    for (size_t i = 0; i < transitions.size(); i++) {
+      if ((detail::fromOf(transitions, i, 0) == state) &&
+          !detail::isAny(detail::eventOf(transitions, i, 0)) && (transitions[i].after > 0))
+        return i;
+    }
+
+    return detail::kNoTransition;
+  }
+};
+
+/**
+ * Dense lookup policy: builds a [state][event] -> transition table and a per-state enter hook table
+ * at construction, so matching a transition and finding the next on_enter hook are a single load.
+ * States and events must be contiguous enums starting at 0, with StateCount and EventCount
+ * members at most. Slots are the smallest integer that indexes MaxTransitions entries, e.g. one
+ * byte each for tables of up to 254 transitions.
+ */
+template <size_t StateCount, size_t EventCount, size_t MaxTransitions = UINT16_MAX - 1>
+class DenseIndex {
+  static_assert(StateCount > 0, "StateCount must be greater than 0!");
+  static_assert(EventCount > 0, "EventCount must be greater than 0!");
+
+  using Slot = detail::UintFor<MaxTransitions + 1>;
+
+  public:
+  template <typename Table>
+  void build(const Table& transitions) {
+    for (auto& slot : _slots)
+      slot = kEmpty;
+    for (size_t state = 0; state < StateCount; state++)
+      _enter[state] = _timed[state] = kEmpty;
+
+    // Keep the first match, as the linear scan does
+    for (size_t i = 0; (i < transitions.size()) && (i < kEmpty); i++) {
+      const size_t state = static_cast<size_t>(transitions[i].from);
+      const size_t event = static_cast<size_t>(transitions[i].event);
+      if (state >= StateCount) continue;
+
+      if (transitions[i].on_enter && (_enter[state] == kEmpty))
+        _enter[state] = static_cast<Slot>(i);
+
+      if (event >= EventCount) continue;
+
+      if ((transitions[i].after > 0) && (_timed[state] == kEmpty))
+        _timed[state] = static_cast<Slot>(i);
+
+      Slot& slot = _slots[state * EventCount + event];
+      if (slot == kEmpty) slot = static_cast<Slot>(i);
+    }
+
+    detail::fillAnyEvent(transitions, _slots, StateCount, EventCount);
+    detail::fillAnyState(transitions, _slots, StateCount, EventCount);
+  }
+
+  size_t getCapacity() const { return kEmpty; }
+
+  template <typename Table, typename StateType, typename EventType>
+  size_t find(const Table&, StateType state, EventType event) const {
+    const size_t s = static_cast<size_t>(state);
+    const size_t e = static_cast<size_t>(event);
+    if ((s >= StateCount) || (e >= EventCount)) return detail::kNoTransition;
+
+    return toIndex(_slots[s * EventCount + e]);
+  }
+
+  template <typename Table, typename StateType>
+  size_t findEnter(const Table&, StateType state) const {
+    const size_t s = static_cast<size_t>(state);
+    if (s >= StateCount) return detail::kNoTransition;
+
+    return toIndex(_enter[s]);
+  }
+
+  template <typename Table, typename StateType>
+  size_t findTimed(const Table&, StateType state) const {
+    const size_t s = static_cast<size_t>(state);
+    if (s >= StateCount) return detail::kNoTransition;
+
+    return toIndex(_timed[s]);
+  }
+
+  private:
+  static constexpr Slot kEmpty = std::numeric_limits<Slot>::max();
+
+  static size_t toIndex(Slot slot) {
+    return slot == kEmpty ? detail::kNoTransition : static_cast<size_t>(slot);
+  }
+
+  Slot _slots[StateCount * EventCount];
+  Slot _enter[StateCount];
+  Slot _timed[StateCount];
+};
+
+/**
+ * Packed lookup policy: the same scan as LinearIndex, over a parallel array of keys of the smallest
+ * width that holds StateCount and EventCount (two bytes per transition for up to 253 of each), so
+ * dispatch only touches a full transition once its key matched. The hooks stay in the table. Same
+ * enum requirements as DenseIndex; only the first MaxTransitions transitions are indexed, and
+ * validate() reports the others as Overflow.
+ */
+template <size_t StateCount, size_t EventCount, size_t MaxTransitions>
+class PackedIndex {
+  static_assert(StateCount > 0, "StateCount must be greater than 0!");
+  static_assert(EventCount > 0, "EventCount must be greater than 0!");
+  static_assert(MaxTransitions > 0, "MaxTransitions must be greater than 0!");
+
+  using StateKey = detail::UintFor<StateCount + 2>;
+  using EventKey = detail::UintFor<EventCount + 2>;
+
+  public:
+  template <typename Table>
+  void build(const Table& transitions) {
+    _count = transitions.size() < MaxTransitions ? transitions.size() : MaxTransitions;
+
+    for (size_t i = 0; i < _count; i++) {
+      _keys[i].from  = encode<StateKey, StateCount>(transitions[i].from, kEntry);
+      _keys[i].event = encode<EventKey, EventCount>(transitions[i].event, kEntry);
+    }
+  }
+
+  size_t getCapacity() const { return MaxTransitions; }
+
+  template <typename Table, typename StateType, typename EventType>
+  size_t find(const Table&, StateType state, EventType event) const {
+    const StateKey from = encode<StateKey, StateCount>(state, kLookup);
+    const EventKey key  = encode<EventKey, EventCount>(event, kLookup);
+    size_t any_event    = detail::kNoTransition;
+    size_t any_state    = detail::kNoTransition;
+    size_t any_both     = detail::kNoTransition;
+
+    for (size_t i = 0; i < _count; i++) {
+      const Key& entry = _keys[i];
+
+      if (entry.from == from) {
+        if (entry.event == key) return i;
+        if ((entry.event == kAnyEvent) && (any_event == detail::kNoTransition)) any_event = i;
+      } else if (entry.from == kAnyState) {
+        if ((entry.event == key) && (any_state == detail::kNoTransition)) any_state = i;
+        if ((entry.event == kAnyEvent) && (any_both == detail::kNoTransition)) any_both = i;
+      }
+    }
+
+    return detail::firstOf(any_event, detail::firstOf(any_state, any_both));
+  }
+
+  template <typename Table, typename StateType>
+  size_t findEnter(const Table& transitions, StateType state) const {
+    const StateKey from = encode<StateKey, StateCount>(state, kLookup);
+    for (size_t i = 0; i < _count; i++) {
+      if ((_keys[i].from == from) && transitions[i].on_enter) return i;
+    }
+
+    return detail::kNoTransition;
+  }
+
+  template <typename Table, typename StateType>
+  size_t findTimed(const Table& transitions, StateType state) const {
+    const StateKey from = encode<StateKey, StateCount>(state, kLookup);
+    for (size_t i = 0; i < _count; i++) {
+      if ((_keys[i].from == from) && (_keys[i].event != kAnyEvent) && (transitions[i].after > 0))
+        return i;
+    }
+
+    return detail::kNoTransition;
+  }
+
+  private:
+  // Wildcards are encoded as Count, other values past the enums as Count + 1 in the table and as
+  // Count + 2 when looked up, so they never match
+  static constexpr StateKey kAnyState = StateCount;
+  static constexpr EventKey kAnyEvent = EventCount;
+  static constexpr size_t kEntry      = 1;
+  static constexpr size_t kLookup     = 2;
+
+  struct Key {
+    StateKey from;
+    EventKey event;
+  };
+
+  template <typename Value, size_t Count, typename Enum>
+  static Value encode(Enum value, size_t past) {
+    if (detail::isAny(value)) return static_cast<Value>(Count);
+
+    const size_t index = static_cast<size_t>(value);
+    return static_cast<Value>(index < Count ? index : Count + past);
+  }
+
+  Key _keys[MaxTransitions];
+  size_t _count;
+};
+
+namespace detail {
+// Number of states known to a lookup policy, 0 when it does not need it
+template <typename Index>
+struct IndexStateCount : std::integral_constant<size_t, 0> {};
+
+template <size_t StateCount, size_t EventCount, size_t MaxTransitions>
+struct IndexStateCount<DenseIndex<StateCount, EventCount, MaxTransitions>>
+    : std::integral_constant<size_t, StateCount> {};
+
+template <size_t StateCount, size_t EventCount, size_t MaxTransitions>
+struct IndexStateCount<PackedIndex<StateCount, EventCount, MaxTransitions>>
+    : std::integral_constant<size_t, StateCount> {};
+} // namespace detail
+
+// Hooks timed by a monitor, in the order a transition runs them
+enum class HookStage : uint8_t { Transition, Exit, Enter };
+
+namespace detail {
+// Free-running tick counter for hook timings: CPU cycles on ESP32, nanoseconds elsewhere
+inline uint32_t readTicks() {
+#if defined(ESP_PLATFORM)
+  #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  return static_cast<uint32_t>(esp_cpu_get_cycle_count());
+  #else
+  return static_cast<uint32_t>(cpu_hal_get_cycle_count());
+  #endif
+#else
+  using namespace std::chrono;
+  return static_cast<uint32_t>(
+    duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Reports the duration of the enclosing scope to a monitor
+template <typename Monitor>
+class HookTimer {
+  public:
+  HookTimer(Monitor& monitor, size_t transition, HookStage stage)
+      : _monitor(monitor)
+      , _transition(transition)
+      , _stage(stage)
+      , _start(monitor.startHook()) {}
+
+  ~HookTimer() { _monitor.endHook(_transition, _stage, _start); }
+
+  HookTimer(const HookTimer&)            = delete;
+  HookTimer& operator=(const HookTimer&) = delete;
+
+  private:
+  Monitor& _monitor;
+  size_t _transition;
+  HookStage _stage;
+  uint32_t _start;
+};
+} // namespace detail
+
+/**
+ * Instrumentation policies of a machine. A monitor is told about every transition taken, by its
+ * index in the table, every NotFound dispatch, the duration of every hook call, and the outcome of
+ * every event (including the ones dropped with Overflow).
+ * - NoMonitor: the default, every call is empty and compiles away, the clock is never read.
+ * - StatsMonitor<T, S, E>: hit counts and hook timings of the first T transitions, and NotFound
+ *   counts of every (state, event) pair among S states and E events.
+ * - TraceMonitor<N>: the last N events in a ring of packed records.
+ * - MonitorPair<A, B>: forwards every call to both.
+ * Custom monitors can derive from NoMonitor and hide only the calls they need.
+ */
+struct NoMonitor {
+  void onTransition(size_t) {}
+  void onNotFound(size_t, size_t) {}
+  uint32_t startHook() { return 0; }
+  void endHook(size_t, HookStage, uint32_t) {}
+
+  template <typename StateType, typename EventType>
+  void onDispatch(StateType, EventType, StateType, TranResult) {}
+};
+
+// Calls of one hook and their duration in ticks: CPU cycles on ESP32, nanoseconds elsewhere
+struct HookTiming {
+  uint32_t calls;
+  uint32_t max;
+  uint64_t total;
+};
+
+struct TransitionStats {
+  uint32_t hits;
+  HookTiming hooks[3]; // Indexed by HookStage
+};
+
+template <size_t TransitionCount, size_t StateCount, size_t EventCount>
+class StatsMonitor : public NoMonitor {
+  static_assert(TransitionCount > 0, "TransitionCount must be greater than 0!");
+  static_assert((StateCount > 0) && (EventCount > 0), "StateCount and EventCount must be > 0!");
+
+  public:
+  struct Stats {
+    TransitionStats transitions[TransitionCount];
+    uint32_t not_found[StateCount][EventCount];
+  };
+
+  StatsMonitor()
+      : _stats() {}
+
+  // Counters are only consistent while the machine is not dispatching
+  const Stats& getStats() const { return _stats; }
+  void snapshot(Stats& stats) const { stats = _stats; }
+  void reset() { std::memset(&_stats, 0, sizeof(_stats)); }
+
+  void onTransition(size_t transition) {
+    if (transition < TransitionCount) _stats.transitions[transition].hits++;
+  }
+
+  void onNotFound(size_t state, size_t event) {
+    if ((state < StateCount) && (event < EventCount)) _stats.not_found[state][event]++;
+  }
+
+  uint32_t startHook() { return detail::readTicks(); }
+
+  void endHook(size_t transition, HookStage stage, uint32_t start) {
+    const uint32_t elapsed = detail::readTicks() - start;
+    if (transition >= TransitionCount) return;
+
+    HookTiming& timing = _stats.transitions[transition].hooks[static_cast<size_t>(stage)];
+    timing.calls++;
+    timing.total += elapsed;
+    if (elapsed > timing.max) timing.max = elapsed;
+  }
+
+  private:
+  Stats _stats;
+};
+
+// One event as seen by a TraceMonitor: tick count (see HookTiming), states before and after it,
+// the event and its TranResult, all as integers
+struct TraceRecord {
+  uint32_t timestamp;
+  uint16_t from;
+  uint16_t to;
+  uint16_t event;
+  uint8_t result;
+  uint8_t reserved;
+};
+
+/**
+ * Ring of the last Capacity events, written in a few stores per dispatch without allocating.
+ * dump() exports it as a little-endian blob, oldest record first:
+ *   "SFT" | version (1) | record count (u16) | record size (u16) | records
+ * with each record laid out as TraceRecord. Capacity must be a power of 2.
+ */
+template <size_t Capacity>
+class TraceMonitor : public NoMonitor {
+  static_assert((Capacity > 0) && ((Capacity & (Capacity - 1)) == 0) && (Capacity <= UINT16_MAX),
+    "Capacity must be a power of 2, up to 32768!");
+
+  public:
+  static constexpr uint8_t kVersion    = 1;
+  static constexpr size_t kHeaderSize  = 8;
+  static constexpr size_t kRecordSize  = 12;
+  static constexpr size_t kMaxDumpSize = kHeaderSize + Capacity * kRecordSize;
+
+  TraceMonitor()
+      : _records()
+      , _written(0) {}
+
+  template <typename StateType, typename EventType>
+  void onDispatch(StateType from, EventType event, StateType to, TranResult result) {
+    TraceRecord& record = _records[_written++ & (Capacity - 1)];
+    record.timestamp    = detail::readTicks();
+    record.from         = static_cast<uint16_t>(from);
+    record.to           = static_cast<uint16_t>(to);
+    record.event        = static_cast<uint16_t>(event);
+    record.result       = static_cast<uint8_t>(result);
+  }
+
+  // Records held, at most Capacity; index 0 is the oldest one
+  size_t size() const { return _written < Capacity ? _written : Capacity; }
+  const TraceRecord& operator[](size_t index) const {
+    return _records[(_written - size() + index) & (Capacity - 1)];
+  }
+
+  void clear() { _written = 0; }
+
+  // Bytes dump() needs for the records held now
+  size_t dumpSize() const { return kHeaderSize + size() * kRecordSize; }
+
+  // Writes the blob to buffer and returns its size, or 0 when buffer is smaller than dumpSize()
+  size_t dump(uint8_t* buffer, size_t buffer_size) const {
+    const size_t count = size();
+    if (buffer_size < dumpSize()) return 0;
+
+    uint8_t* out = buffer;
+    *out++       = 'S';
+    *out++       = 'F';
+    *out++       = 'T';
+    *out++       = kVersion;
+    out          = put(out, static_cast<uint16_t>(count));
+    out          = put(out, static_cast<uint16_t>(kRecordSize));
+
+    for (size_t i = 0; i < count; i++) {
+      const TraceRecord& record = (*this)[i];
+      out                       = put(out, record.timestamp);
+      out                       = put(out, record.from);
+      out                       = put(out, record.to);
+      out                       = put(out, record.event);
+      *out++                    = record.result;
+      *out++                    = 0;
+    }
+
+    return static_cast<size_t>(out - buffer);
+  }
+
+  private:
+  template <typename Integer>
+  static uint8_t* put(uint8_t* out, Integer value) {
+    for (size_t byte = 0; byte < sizeof(Integer); byte++)
+      *out++ = static_cast<uint8_t>(value >> (8 * byte));
+
+    return out;
+  }
+
+  TraceRecord _records[Capacity];
+  size_t _written;
+};
+
+// Outcome of replayTrace()
+enum class ReplayResult : uint8_t { Match, Mismatch, Invalid };
+
+// Counters of a replayTrace() run; ticks are those of HookTiming, summed over the dispatches
+struct ReplayReport {
+  size_t records;    // Records in the trace
+  size_t matched;    // Records reproduced in order, before the first mismatch
+  size_t dispatches; // Events fed to the machine
+  uint64_t ticks;
+};
+
+namespace detail {
+template <typename Integer>
+Integer readLittle(const uint8_t* in) {
+  Integer value = 0;
+  for (size_t byte = 0; byte < sizeof(Integer); byte++)
+    value |= static_cast<Integer>(static_cast<Integer>(in[byte]) << (8 * byte));
+
+  return value;
+}
+
+// Record of a TraceMonitor dump, see TraceMonitor for the layout
+inline TraceRecord readRecord(const uint8_t* in) {
+  TraceRecord record;
+  record.timestamp = readLittle<uint32_t>(in);
+  record.from      = readLittle<uint16_t>(in + 4);
+  record.to        = readLittle<uint16_t>(in + 6);
+  record.event     = readLittle<uint16_t>(in + 8);
+  record.result    = in[10];
+  record.reserved  = 0;
+  return record;
+}
+
+inline bool sameRecord(const TraceRecord& a, const TraceRecord& b) {
+  return (a.from == b.from) && (a.to == b.to) && (a.event == b.event) && (a.result == b.result);
+}
+
+// Recorded by a dispatch from inside a hook, which the hook makes again on replay
+inline bool isNested(const TraceRecord& record) {
+  return record.result == static_cast<uint8_t>(TranResult::Overflow);
+}
+} // namespace detail
+
+/**
+ * Feeds a trace dumped by a TraceMonitor to machine, built from the same table and recording into
+ * monitor (its own monitor, or part of a MonitorPair), and checks it takes the same transitions as
+ * recorded, timestamps aside. This reproduces field traces on a host, and the report gives the
+ * dispatch throughput to compare versions with.
+ *
+ * Every event dispatched from outside the machine is dispatched again, in order; events that hooks
+ * dispatched, recorded after the outer one, or before it when dropped as Overflow, are not, the
+ * hooks dispatch them again. monitor is cleared before each dispatch and must hold all the records
+ * of one. machine must start in the from state of the first record, e.g.
+ * through resetState() or restore(). Returns Invalid when trace is not a dump, and Mismatch at the
+ * first record that differs, with report.matched records reproduced up to there.
+ */
+template <typename Machine, size_t Capacity>
+ReplayResult replayTrace(Machine& machine, TraceMonitor<Capacity>& monitor, const uint8_t* trace,
+  size_t size, ReplayReport& report) {
+  using Recorder = TraceMonitor<Capacity>;
+  report         = ReplayReport();
+
+  if ((size < Recorder::kHeaderSize) || (trace[0] != 'S') || (trace[1] != 'F') ||
+      (trace[2] != 'T') || (trace[3] != Recorder::kVersion))
+    return ReplayResult::Invalid;
+
+  const size_t count       = detail::readLittle<uint16_t>(trace + 4);
+  const size_t record_size = detail::readLittle<uint16_t>(trace + 6);
+  if ((record_size < Recorder::kRecordSize) || (size < Recorder::kHeaderSize + count * record_size))
+    return ReplayResult::Invalid;
+
+  const uint8_t* records = trace + Recorder::kHeaderSize;
+  auto recordAt          = [&](size_t index) {
+    return detail::readRecord(records + index * record_size);
+  };
+
+  report.records = count;
+
+  while (report.matched < count) {
+    size_t outside = report.matched;
+    while ((outside < count) && detail::isNested(recordAt(outside))) outside++;
+
+    if (outside == count) return ReplayResult::Mismatch;
+
+    const TraceRecord expected = recordAt(outside);
+    if (static_cast<size_t>(machine.getCurrentState()) != expected.from)
+      return ReplayResult::Mismatch;
+
+    monitor.clear();
+    const uint32_t start = detail::readTicks();
+    machine.dispatch(static_cast<typename Machine::Event>(expected.event));
+    report.ticks += detail::readTicks() - start;
+    report.dispatches++;
+
+    if (monitor.size() == 0) return ReplayResult::Mismatch;
+
+    for (size_t i = 0; i < monitor.size(); i++) {
+      if ((report.matched == count) || !detail::sameRecord(monitor[i], recordAt(report.matched)))
+        return ReplayResult::Mismatch;
+
+      report.matched++;
+    }
+  }
+
+  return ReplayResult::Match;
+}
+
+template <typename First, typename Second>
+class MonitorPair {
+  public:
+  First& first() { return _first; }
+  const First& first() const { return _first; }
+  Second& second() { return _second; }
+  const Second& second() const { return _second; }
+
+  void onTransition(size_t transition) {
+    _first.onTransition(transition);
+    _second.onTransition(transition);
+  }
+
+  void onNotFound(size_t state, size_t event) {
+    _first.onNotFound(state, event);
+    _second.onNotFound(state, event);
+  }
+
+  // Both are timed from the same start
+  uint32_t startHook() {
+    _second.startHook();
+    return _first.startHook();
+  }
+
+  void endHook(size_t transition, HookStage stage, uint32_t start) {
+    _first.endHook(transition, stage, start);
+    _second.endHook(transition, stage, start);
+  }
+
+  template <typename StateType, typename EventType>
+  void onDispatch(StateType from, EventType event, StateType to, TranResult result) {
+    _first.onDispatch(from, event, to, result);
+    _second.onDispatch(from, event, to, result);
+  }
+
+  private:
+  First _first;
+  Second _second;
+};
+
+// Outcome of looking up a transition without running it
+enum class TransitionKind : uint8_t { Missing, Direct, Hooked };
+
+/**
+ * Transition table, lookup index and initial state, without any per-instance state. A single
+ * definition can be shared by many instances (see InstancePool); StateMachine owns one.
+ */
+template <typename StateType, typename EventType, typename Index = LinearIndex,
+  template <typename> class Hook = std::function, typename Storage = HeapStorage,
+  typename ContextType = Context>
+class MachineDefinition {
+  static_assert(std::is_enum<StateType>::value, "StateType must be an enum class!");
+  static_assert(std::is_enum<EventType>::value, "EventType must be an enum class!");
+
+  public:
+  using State           = StateType;
+  using Event           = EventType;
+  using ContextPointer  = ContextType*;
+  using TransitionType  = Transition<StateType, EventType, Hook, ContextType>;
+  using DescriptorType  = StateDescriptor<StateType, EventType, Hook, ContextType>;
+  using TransitionTable = typename Storage::template Container<TransitionType>;
+
+  // Number of states when Index knows it (DenseIndex), 0 otherwise
+  static constexpr size_t kStateCount = detail::IndexStateCount<Index>::value;
+
+  MachineDefinition(StateType initial_state, std::initializer_list<TransitionType> transitions)
+      : MachineDefinition(initial_state, {}, transitions) {}
+
+  MachineDefinition(StateType initial_state, std::initializer_list<DescriptorType> states,
+    std::initializer_list<TransitionType> transitions)
+      : _initial_state(initial_state)
+      , _states(states)
+      , _transitions(transitions) {
+    _index.build(_transitions);
+  }
+
+  // Required by BufferStorage, the arrays are not copied and must outlive the definition
+  MachineDefinition(StateType initial_state, const TransitionType* transitions, size_t count)
+      : MachineDefinition(initial_state, nullptr, 0, transitions, count) {}
+
+  MachineDefinition(StateType initial_state, const DescriptorType* states, size_t state_count,
+    const TransitionType* transitions, size_t count)
+      : _initial_state(initial_state)
+      , _states(states, states + state_count)
+      , _transitions(transitions, transitions + count) {
+    _index.build(_transitions);
+  }
+
+  ~MachineDefinition()                                   = default;
+  MachineDefinition(const MachineDefinition&)            = delete;
+  MachineDefinition& operator=(const MachineDefinition&) = delete;
+  MachineDefinition(MachineDefinition&&)                 = delete;
+  MachineDefinition& operator=(MachineDefinition&&)      = delete;
+
+  StateType getInitialState() const { return _initial_state; }
+
+  // The transition table as declared, e.g. for a GraphExporter
+  const TransitionTable& getTransitions() const { return _transitions; }
+
+  // Runs the transition for event from state, and stores the next state in state on commit
+  TranResult step(StateType& state, EventType event) const {
+    NoMonitor monitor;
+    return step(state, event, monitor);
+  }
+
+  // Same as step(), reporting the taken transition and its hook timings to monitor
+  template <typename Monitor>
+  TranResult step(StateType& state, EventType event, Monitor& monitor) const {
+    TranResult result  = TranResult::Change;
+    const size_t match = select(state, event, result, monitor);
+    if (match == detail::kNoTransition) return result;
+
+    // Wildcard transitions report the actual state and event to their hooks
+    const auto& transition = _transitions[match];
+    if (transition.on_transition) {
+      const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Transition);
+      result = transition.on_transition(detail::isAny(transition.from) ? state : transition.from,
+        detail::isAny(transition.event) ? event : transition.event,
+        transition.to,
+        transition.context);
+    }
+
+    return commit(state, event, match, result, monitor);
+  }
+
+  /**
+   * step() in two halves, for machines that run on_transition themselves (AsyncStateMachine).
+   * select() returns the index of the enabled transition, or SIZE_MAX with the result to report.
+   */
+  template <typename Monitor>
+  size_t select(StateType state, EventType event, TranResult& result, Monitor& monitor) const {
+    const size_t found = _index.find(_transitions, state, event);
+    if (found == detail::kNoTransition) {
+      monitor.onNotFound(static_cast<size_t>(state), static_cast<size_t>(event));
+      result = TranResult::NotFound;
+      return found;
+    }
+
+    const size_t match = detail::firstEnabled(_transitions, found, state, event);
+    if (match == detail::kNoTransition) {
+      result = TranResult::NoChange;
+      return match;
+    }
+
+    monitor.onTransition(match);
+    result = TranResult::Change;
+    return match;
+  }
+
+  const TransitionType& getTransition(size_t index) const { return _transitions[index]; }
+
+  // Runs the exit and enter hooks of the selected transition for the on_transition result
+  template <typename Monitor>
+  TranResult commit(StateType& state, EventType event, size_t match, TranResult result,
+    Monitor& monitor) const {
+    const auto& transition  = _transitions[match];
+    const StateType from    = detail::isAny(transition.from) ? state : transition.from;
+    const EventType trigger = detail::isAny(transition.event) ? event : transition.event;
+
+    if (transition.on_exit) {
+      const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Exit);
+      transition.on_exit(from, trigger, transition.to, transition.context);
+    }
+
+    // If the transition result is Reset, it will execute the on_enter hook of the initial state
+    // Else, it will execute the on_enter hook of the next state
+    StateType next_state = result == TranResult::Reset ? _initial_state : transition.to;
+
+    if (_states.size() > 0) {
+      const auto* source = detail::descriptorOf(_states, from);
+      if (source && source->on_exit) {
+        const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Exit);
+        source->on_exit(from, trigger, transition.to, source->context);
+      }
+    }
+
+    enter(next_state, from, trigger, transition.to, monitor, match);
+
+    switch (result) {
+      case TranResult::Change: state = transition.to; return result;
+      case TranResult::Reset: state = _initial_state; return result;
+      default: return result;
+    }
+  }
+
+  /**
+   * Looks up the transition for event from state without running it. Direct means step() would
+   * run no hook at all and move to next; Hooked means it has to go through step().
+   */
+  TransitionKind classify(StateType state, EventType event, StateType& next) const {
+    const size_t match = _index.find(_transitions, state, event);
+    if (match == detail::kNoTransition) return TransitionKind::Missing;
+
+    const auto& transition = _transitions[match];
+    if (transition.guard || transition.on_transition || transition.on_exit ||
+        hasStateHook(state, transition.to))
+      return TransitionKind::Hooked;
+
+    next = transition.to;
+    return TransitionKind::Direct;
+  }
+
+  // Index of the timed transition of state, detail::kNoTransition when it has none
+  size_t findTimed(StateType state) const { return _index.findTimed(_transitions, state); }
+
+  // Delay and event of the timed transition of state, or 0 when it has none
+  uint32_t getTimeout(StateType state, EventType& event) const {
+    const size_t timed = _index.findTimed(_transitions, state);
+    if (timed == detail::kNoTransition) return 0;
+
+    event = _transitions[timed].event;
+    return _transitions[timed].after;
+  }
+
+  // First problem of the table (see TableIssue); a one-shot pass, e.g. once from setup()
+  TableCheck validate() const {
+    const size_t dropped = detail::firstDropped(_transitions, _index.getCapacity());
+    if (dropped != detail::kNoTransition) return {TableIssue::Overflow, dropped};
+
+    return detail::checkTable(_transitions, _initial_state, kStateCount, detail::bitOf<StateType>);
+  }
+
+  // Whether state can be made current; any value is accepted when the state count is unknown
+  bool hasState(StateType state) const {
+    return (kStateCount == 0) || (static_cast<size_t>(state) < kStateCount);
+  }
+
+  // Runs the enter hook of state as if it was re-entered, with any<EventType>() as event
+  void enterState(StateType state) const {
+    NoMonitor monitor;
+    enter(state, state, any<EventType>(), state, monitor, detail::kNoTransition);
+  }
+
+  // Whether a transition matches event from state, guards not evaluated; does no side effect
+  bool accepts(StateType state, EventType event) const {
+    return _index.find(_transitions, state, event) != detail::kNoTransition;
+  }
+
+  // Whether some transition may fire for event, any event wildcards included; a linear scan
+  bool handles(EventType event) const {
+    for (const auto& transition : _transitions) {
+      if ((transition.event == event) || detail::isAny(transition.event)) return true;
+    }
+
+    return false;
+  }
+
+  ContextType* getContext(StateType from, EventType event, StateType to) const {
+    for (const auto& transition : _transitions) {
+      if ((transition.from == from) && (transition.event == event) && (transition.to == to)) {
+        return transition.context;
+      }
+    }
+
+    return nullptr;
+  }
+
+  private:
+  template <typename Monitor>
+  void enter(StateType state, StateType from, EventType event, StateType to, Monitor& monitor,
+    size_t match) const {
+    if (_states.size() > 0) {
+      const auto* target = detail::descriptorOf(_states, state);
+      if (target && target->on_enter) {
+        const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Enter);
+        target->on_enter(from, event, to, target->context);
+      }
+    } else {
+      const size_t found = _index.findEnter(_transitions, state);
+      if (found != detail::kNoTransition) {
+        const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Enter);
+        const auto& transition = _transitions[found];
+        transition.on_enter(from, event, to, transition.context);
+      }
+    }
+  }
+
+  // True when going from one state to the other runs a state enter or exit hook
+  bool hasStateHook(StateType from, StateType to) const {
+    if (_states.size() == 0) return _index.findEnter(_transitions, to) != detail::kNoTransition;
+
+    const auto* source = detail::descriptorOf(_states, from);
+    const auto* target = detail::descriptorOf(_states, to);
+    return (source && source->on_exit) || (target && target->on_enter);
+  }
+
+  StateType _initial_state;
+  typename Storage::template Container<DescriptorType> _states;
+  TransitionTable _transitions;
+  Index _index;
+};
+
+namespace detail {
+struct NoMemory {};
+
+template <typename...>
+struct Void {
+  using type = void;
+};
+
+// Per-machine memory a definition steps with (the history of HierarchicalDefinition), if any
+template <typename Definition, typename = void>
+struct MemoryOf {
+  using type = NoMemory;
+};
+
+template <typename Definition>
+struct MemoryOf<Definition, typename Void<typename Definition::Memory>::type> {
+  using type = typename Definition::Memory;
+};
+
+template <typename Definition, typename StateType, typename EventType, typename Monitor>
+TranResult stepWith(const Definition& definition, StateType& state, EventType event,
+  Monitor& monitor, NoMemory&) {
+  return definition.step(state, event, monitor);
+}
+
+template <typename Definition, typename StateType, typename EventType, typename Monitor,
+  typename Memory>
+TranResult stepWith(const Definition& definition, StateType& state, EventType event,
+  Monitor& monitor, Memory& memory) {
+  return definition.step(state, event, monitor, memory);
+}
+} // namespace detail
+
+/**
+ * Current state of one machine over a definition (MachineDefinition or HierarchicalDefinition),
+ * with run-to-completion dispatch and an instrumentation Monitor. Use StateMachine or
+ * HierarchicalStateMachine.
+ */
+template <typename Definition, typename Monitor = NoMonitor>
+class BasicStateMachine
+    : private Monitor
+    , private detail::MemoryOf<Definition>::type {
+  using Memory = typename detail::MemoryOf<Definition>::type;
+
+  public:
+  using State          = typename Definition::State;
+  using Event          = typename Definition::Event;
+  using TransitionType = typename Definition::TransitionType;
+
+  ~BasicStateMachine()                                   = default;
+  BasicStateMachine(const BasicStateMachine&)            = delete;
+  BasicStateMachine& operator=(const BasicStateMachine&) = delete;
+  BasicStateMachine(BasicStateMachine&&)                 = delete;
+  BasicStateMachine& operator=(BasicStateMachine&&)      = delete;
+
+  /**
+   * Runs the transition for event. Events dispatched from inside a hook of this machine are not
+   * recursed into: they return Deferred (or Overflow when the queue is full) and run in order once
+   * the current transition has been committed.
+   */
+  TranResult dispatch(Event event) { return dispatchWith(event, detail::PayloadRef()); }
+
+  /**
+   * Same as dispatch(event), and the hooks run for this event can read payload via getPayload().
+   * The payload is referenced, never copied, so it only has to outlive this call. When it is
+   * Deferred, it is copied instead into the fixed storage of the queue, which holds trivially
+   * copyable payloads of up to STATEFORGE_RTC_PAYLOAD_SIZE bytes: any other one returns Overflow.
+   */
+  template <typename Payload>
+  TranResult dispatch(Event event, const Payload& payload) {
+    if (!_rtc.isBusy()) return dispatchWith(event, detail::PayloadRef::of(payload));
+    return deferCopy(event, payload, detail::FitsDeferred<Payload>());
+  }
+
+  // Payload of the event being processed when it is a Payload, nullptr otherwise
+  template <typename Payload>
+  const Payload* getPayload() const {
+    return _payload.template get<Payload>();
+  }
+
+  /**
+   * Dispatches count events in order, with the same semantics as calling dispatch() for each, and
+   * stops right after the first one whose result is in stop_on. The current state is cached
+   * locally for the whole batch, so hooks must not call resetState() meanwhile.
+   */
+  BatchResult dispatchAll(const Event* events, size_t count, ResultMask stop_on = ResultMask()) {
+    BatchResult batch = {0, TranResult::NoChange};
+
+    if (_rtc.isBusy()) {
+      for (; batch.processed < count; batch.processed++) {
+        batch.result = defer(Deferred::of(events[batch.processed]));
+        if (batch.result == TranResult::Overflow) return batch;
+      }
+
+      return batch;
+    }
+
+    _rtc.setBusy(true);
+    State state = _current_state;
+
+    while (batch.processed < count) {
+      batch.result = process(state, events[batch.processed++], detail::PayloadRef());
+      drainDeferred(state);
+
+      if (stop_on.has(batch.result)) break;
+    }
+
+    _rtc.setBusy(false);
+    return batch;
+  }
+
+  State getCurrentState() { return _current_state; }
+
+  // Also forgets the history of a hierarchical machine
+  void resetState() {
+    _current_state = _definition.getInitialState();
+    memory()       = Memory();
+  }
+
+  // Trivially copyable image of the current state, small enough for RTC memory or NVS
+  struct Snapshot {
+    State state;
+    uint8_t seal; // Inverted low byte of state, so zeroed or random memory is rejected
+  };
+
+  // Take it outside of dispatch: while a hook runs, the committed state may be behind
+  Snapshot snapshot() const {
+    return {_current_state, static_cast<uint8_t>(~static_cast<size_t>(_current_state))};
+  }
+
+  /**
+   * Makes the snapshot state current in O(1), without running any hook unless enter is true: then
+   * its enter hooks run (from the root down on a hierarchical machine) with the state as from and
+   * to and any<Event>() as event. Returns false, leaving the machine untouched, while dispatching
+   * or when the snapshot is not sealed or names a state the definition does not have. The history
+   * of a hierarchical machine is not part of the snapshot, so it is forgotten as by resetState().
+   */
+  bool restore(const Snapshot& snapshot, bool enter = false) {
+    if (_rtc.isBusy()) return false;
+    if (snapshot.seal != static_cast<uint8_t>(~static_cast<size_t>(snapshot.state))) return false;
+    if (!_definition.hasState(snapshot.state)) return false;
+
+    _current_state = snapshot.state;
+    memory()       = Memory();
+    if (enter) _definition.enterState(snapshot.state);
+    return true;
+  }
+
+  typename Definition::ContextPointer const getContext(State from, Event event, State to) const {
+    return _definition.getContext(from, event, to);
+  }
+
+  const Definition& getDefinition() const { return _definition; }
+  TableCheck validate() const { return _definition.validate(); }
+
+  Monitor& getMonitor() { return *this; }
+  const Monitor& getMonitor() const { return *this; }
+
+  protected:
+  template <typename... Args>
+  BasicStateMachine(State initial_state, Args&&... args)
+      : _definition(initial_state, std::forward<Args>(args)...)
+      , _current_state(initial_state)
+      , _payload() {}
+
+  private:
+  using Deferred = detail::DeferredEvent<Event>;
+
+  TranResult dispatchWith(Event event, detail::PayloadRef payload) {
+    if (_rtc.isBusy()) return defer(Deferred::of(event));
+
+    _rtc.setBusy(true);
+    State state             = _current_state;
+    const TranResult result = process(state, event, payload);
+    drainDeferred(state);
+
+    _rtc.setBusy(false);
+    return result;
+  }
+
+  TranResult defer(const Deferred& deferred) {
+    return _rtc.push(deferred) ? TranResult::Deferred : overflow(deferred.event);
+  }
+
+  template <typename Payload>
+  TranResult deferCopy(Event event, const Payload& payload, std::true_type) {
+    return defer(Deferred::of(event, payload));
+  }
+
+  template <typename Payload>
+  TranResult deferCopy(Event event, const Payload&, std::false_type) {
+    return overflow(event);
+  }
+
+  TranResult overflow(Event event) {
+    getMonitor().onDispatch(_current_state, event, _current_state, TranResult::Overflow);
+    return TranResult::Overflow;
+  }
+
+  void drainDeferred(State& state) {
+    Deferred deferred;
+    while (_rtc.pop(deferred))
+      process(state, deferred.event, deferred.payload());
+  }
+
+  TranResult process(State& state, Event event, detail::PayloadRef payload) {
+    const State from        = state;
+    _payload                = payload;
+    const TranResult result = detail::stepWith(_definition, state, event, getMonitor(), memory());
+    _current_state          = state;
+    _payload                = detail::PayloadRef();
+
+    getMonitor().onDispatch(from, event, state, result);
+    return result;
+  }
+
+  Memory& memory() { return *this; }
+
+  Definition _definition;
+  State _current_state;
+  detail::PayloadRef _payload;
+  detail::RunToCompletion<Deferred, STATEFORGE_RTC_QUEUE_SIZE> _rtc;
+};
+
+template <typename StateType, typename EventType, typename Index = LinearIndex,
+  template <typename> class Hook = std::function, typename Storage = HeapStorage,
+  typename Monitor = NoMonitor, typename ContextType = Context>
+class StateMachine
+    : public BasicStateMachine<
+        MachineDefinition<StateType, EventType, Index, Hook, Storage, ContextType>,
+        Monitor> {
+  using Base = BasicStateMachine<
+    MachineDefinition<StateType, EventType, Index, Hook, Storage, ContextType>,
+    Monitor>;
+
+  public:
+  using Definition     = MachineDefinition<StateType, EventType, Index, Hook, Storage, ContextType>;
+  using TransitionType = typename Definition::TransitionType;
+  using DescriptorType = typename Definition::DescriptorType;
+
+  StateMachine(StateType initial_state, std::initializer_list<TransitionType> transitions)
+      : Base(initial_state, transitions) {}
+
+  StateMachine(StateType initial_state, std::initializer_list<DescriptorType> states,
+    std::initializer_list<TransitionType> transitions)
+      : Base(initial_state, states, transitions) {}
+
+  // Required by BufferStorage, the arrays are not copied and must outlive the machine
+  StateMachine(StateType initial_state, const TransitionType* transitions, size_t count)
+      : Base(initial_state, transitions, count) {}
+
+  StateMachine(StateType initial_state, const DescriptorType* states, size_t state_count,
+    const TransitionType* transitions, size_t count)
+      : Base(initial_state, states, state_count, transitions, count) {}
+};
+
+/**
+ * StateMachine using a DenseIndex: O(1) dispatch at the cost of StateCount * EventCount lookup
+ * slots per instance.
+ */
+template <typename StateType, typename EventType, size_t StateCount, size_t EventCount,
+  template <typename> class Hook = std::function, typename Storage = HeapStorage,
+  typename Monitor = NoMonitor, typename ContextType = Context>
+using IndexedStateMachine = StateMachine<StateType, EventType, DenseIndex<StateCount, EventCount>,
+  Hook, Storage, Monitor, ContextType>;
+
+/**
+ * Count instances of a shared MachineDefinition. Only the current state of each instance is stored,
+ * contiguously, so memory is O(transitions + instances). Hooks are shared by all instances and can
+ * call getActiveInstance() to know which one they run for.
+ */
+template <typename Definition, size_t Count>
+class InstancePool {
+  static_assert(Count > 0, "Count must be greater than 0!");
+
+  public:
+  using StateType = typename Definition::State;
+  using EventType = typename Definition::Event;
+
+  InstancePool(const Definition& definition)
+      : _definition(definition)
+      , _active(0) {
+    resetAll();
+  }
+
+  InstancePool(const InstancePool&)            = delete;
+  InstancePool& operator=(const InstancePool&) = delete;
+
+  // Same run-to-completion rules as StateMachine::dispatch(), shared by all instances
+  TranResult dispatch(size_t instance, EventType event) {
+    if (instance >= Count) return TranResult::NotFound;
+    if (_rtc.isBusy()) {
+      return _rtc.push(Pending{instance, event}) ? TranResult::Deferred : TranResult::Overflow;
+    }
+
+    _rtc.setBusy(true);
+    const TranResult result = process(instance, event);
+    drainDeferred();
+
+    _rtc.setBusy(false);
+    return result;
+  }
+
+  /**
+   * Dispatches event to every instance in index order, like calling dispatch() for each, and
+   * returns how many of them had a transition for it. Requires a DenseIndex definition.
+   * The outcome for each state is resolved once per call; instances whose transition runs no hook
+   * are updated through that lookup table (16 per iteration with SSSE3/NEON when states are 1 byte
+   * wide and there are at most 16 of them), and only the others go through step().
+   * From inside a hook, the broadcast is queued like dispatch() and nothing is counted.
+   */
+  BroadcastResult broadcast(EventType event) {
+    if (_rtc.isBusy()) {
+      const bool queued = _rtc.push(Pending{kAllInstances, event});
+      return {0, queued ? TranResult::Deferred : TranResult::Overflow};
+    }
+
+    _rtc.setBusy(true);
+    const size_t matched = broadcastAll(event);
+    drainDeferred();
+
+    _rtc.setBusy(false);
+    return {matched, TranResult::Change};
+  }
+
+  StateType getCurrentState(size_t instance) const { return _states[instance]; }
+  void resetState(size_t instance) { _states[instance] = _definition.getInitialState(); }
+
+  void resetAll() {
+    for (auto& state : _states)
+      state = _definition.getInitialState();
+  }
+
+  size_t getActiveInstance() const { return _active; }
+  const StateType* getStates() const { return _states; }
+
+  /**
+   * Sets the state of every instance from an array of size() states, e.g. a copy of getStates()
+   * kept in RTC memory. No hook runs. Returns false, changing nothing, while dispatching or when
+   * any state is not one of the definition.
+   */
+  bool restoreStates(const StateType* states) {
+    if (_rtc.isBusy()) return false;
+    for (size_t i = 0; i < Count; i++) {
+      if (!_definition.hasState(states[i])) return false;
+    }
+
+    for (size_t i = 0; i < Count; i++)
+      _states[i] = states[i];
+    return true;
+  }
+  static constexpr size_t size() { return Count; }
+
+  const Definition& getDefinition() const { return _definition; }
+
+  private:
+  static constexpr size_t kAllInstances = SIZE_MAX;
+
+  struct Pending {
+    size_t instance;
+    EventType event;
+  };
+
+  void drainDeferred() {
+    Pending deferred;
+    while (_rtc.pop(deferred)) {
+      if (deferred.instance == kAllInstances)
+        broadcastAll(deferred.event);
+      else
+        process(deferred.instance, deferred.event);
+    }
+  }
+
+  TranResult process(size_t instance, EventType event) {
+    _active = instance;
+    return _definition.step(_states[instance], event);
+  }
+
+  size_t broadcastAll(EventType event) {
+    constexpr size_t kSize = Definition::kStateCount;
+    static_assert(kSize > 0, "broadcast() requires a definition with a known state count!");
+
+    // Per state: next state and kind of the transition for this event
+    StateType next[kSize];
+    TransitionKind kind[kSize];
+
+    for (size_t state = 0; state < kSize; state++) {
+      next[state] = static_cast<StateType>(state);
+      kind[state] = _definition.classify(next[state], event, next[state]);
+    }
+
+    constexpr bool kGather = STATEFORGE_SIMD_GATHER && (sizeof(StateType) == 1) && (kSize <= 16);
+    return gather(event, next, kind, std::integral_constant<bool, kGather>());
+  }
+
+  // Handles instances [first, last) one by one
+  size_t stepRange(size_t first, size_t last, EventType event, const StateType* next,
+    const TransitionKind* kind, size_t state_count) {
+    size_t matched = 0;
+
+    for (size_t i = first; i < last; i++) {
+      const size_t state = static_cast<size_t>(_states[i]);
+      if (state >= state_count) continue;
+
+      switch (kind[state]) {
+        case TransitionKind::Missing: break;
+        case TransitionKind::Direct:
+          _states[i] = next[state];
+          matched++;
+          break;
+        case TransitionKind::Hooked:
+          process(i, event);
+          matched++;
+          break;
+      }
+    }
+
+    return matched;
+  }
+
+  template <size_t StateCount>
+  size_t gather(EventType event, const StateType (&next)[StateCount],
+    const TransitionKind (&kind)[StateCount], std::false_type) {
+    return stepRange(0, Count, event, next, kind, StateCount);
+  }
+
+#if STATEFORGE_SIMD_GATHER
+  // 16 instances per iteration: one byte shuffle maps current to next states, lanes whose
+  // transition has hooks are flagged with bit 7 and the whole block then falls back to stepRange()
+  template <size_t StateCount>
+  size_t gather(EventType event, const StateType (&next)[StateCount],
+    const TransitionKind (&kind)[StateCount], std::true_type) {
+    alignas(16) uint8_t lut[16] = {};
+    alignas(16) uint8_t hit[16] = {};
+
+    // States past StateCount, which a table can send instances to, are left as in stepRange()
+    for (size_t state = StateCount; state < 16; state++)
+      lut[state] = static_cast<uint8_t>(state);
+
+    for (size_t state = 0; state < StateCount; state++) {
+      switch (kind[state]) {
+        case TransitionKind::Missing: lut[state] = static_cast<uint8_t>(state); break;
+        case TransitionKind::Direct: lut[state] = static_cast<uint8_t>(next[state]); break;
+        case TransitionKind::Hooked: lut[state] = static_cast<uint8_t>(0x80 | state); break;
+      }
+
+      hit[state] = kind[state] == TransitionKind::Missing ? 0 : 1;
+    }
+
+    uint8_t* const states = reinterpret_cast<uint8_t*>(_states);
+    size_t matched        = 0;
+    size_t i              = 0;
+
+  #if defined(__SSSE3__)
+    const __m128i table = _mm_load_si128(reinterpret_cast<const __m128i*>(lut));
+    const __m128i hits  = _mm_load_si128(reinterpret_cast<const __m128i*>(hit));
+    const __m128i high  = _mm_set1_epi8(static_cast<char>(0xF0));
+    const __m128i zero  = _mm_setzero_si128();
+
+    for (; i + 16 <= Count; i += 16) {
+      const __m128i current  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(states + i));
+      const __m128i in_range = _mm_cmpeq_epi8(_mm_and_si128(current, high), zero);
+      const __m128i mapped   = _mm_shuffle_epi8(table, current);
+
+      if ((_mm_movemask_epi8(in_range) != 0xFFFF) || (_mm_movemask_epi8(mapped) != 0)) {
+        matched += stepRange(i, i + 16, event, next, kind, StateCount);
+        continue;
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(states + i), mapped);
+      const __m128i sums = _mm_sad_epu8(_mm_shuffle_epi8(hits, current), zero);
+      matched += static_cast<size_t>(_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+    }
+  #else
+    const uint8x16_t table = vld1q_u8(lut);
+    const uint8x16_t hits  = vld1q_u8(hit);
+
+    for (; i + 16 <= Count; i += 16) {
+      const uint8x16_t current = vld1q_u8(states + i);
+      const uint8x16_t mapped  = vqtbl1q_u8(table, current);
+
+      if ((vmaxvq_u8(current) >= 16) || (vmaxvq_u8(mapped) & 0x80)) {
+        matched += stepRange(i, i + 16, event, next, kind, StateCount);
+        continue;
+      }
+
+      vst1q_u8(states + i, mapped);
+      matched += vaddvq_u8(vqtbl1q_u8(hits, current));
+    }
+  #endif
+
+    return matched + stepRange(i, Count, event, next, kind, StateCount);
+  }
+#endif
+
+  const Definition& _definition;
+  StateType _states[Count];
+  size_t _active;
+  detail::RunToCompletion<Pending, STATEFORGE_RTC_QUEUE_SIZE> _rtc;
+};
+
+// Kind of history pseudo-state, see StateParent
+enum class HistoryKind : uint8_t { None, Shallow, Deep };
+
+/**
+ * Declares parent as the enclosing state of state in a HierarchicalStateMachine. With a history
+ * kind, state is instead a history pseudo-state of parent: a transition to it enters the child of
+ * parent that was active when parent was last exited (Shallow), or that child's innermost active
+ * state (Deep), and parent itself when it was never exited. The machine is never in state.
+ */
+template <typename StateType>
+struct StateParent {
+  // history is defaulted, so plain (state, parent) pairs build without missing initializer warnings
+  constexpr StateParent(StateType state, StateType parent, HistoryKind history = HistoryKind::None)
+      : state(state)
+      , parent(parent)
+      , history(history) {}
+
+  StateType state;
+  StateType parent;
+  HistoryKind history;
+};
+
+/**
+ * Definition with nested states. An event not handled by the current state bubbles up to its
+ * ancestors, and a transition exits every state from the current one up to the least common
+ * ancestor of its source and target, then enters every state down to the target. Both the bubbling
+ * and the exit/enter depths are resolved per (state, event) at construction.
+ *
+ * A state's enter hook is resolved as in StateMachine; its exit hook is the on_exit of the taken
+ * transition for the source state, and the first on_exit declared from it for the other ones. With
+ * state descriptors, every entered and exited state runs its descriptor hooks instead, the source
+ * state after the on_exit of the taken transition.
+ * States whose parent chain is deeper than STATEFORGE_MAX_DEPTH, or loops, are kept top-level.
+ *
+ * History pseudo-states (see StateParent) resume from a Memory each machine keeps: the last active
+ * innermost state of every exited state, one slot per state, written along the exit path. Steps
+ * without a Memory, as in an InstancePool, enter the parent of the pseudo-state.
+ */
+template <typename StateType, typename EventType, size_t StateCount, size_t EventCount,
+  template <typename> class Hook = std::function, typename Storage = HeapStorage,
+  typename ContextType = Context>
+class HierarchicalDefinition {
+  static_assert(std::is_enum<StateType>::value, "StateType must be an enum class!");
+  static_assert(std::is_enum<EventType>::value, "EventType must be an enum class!");
+  static_assert((StateCount > 0) && (StateCount < UINT16_MAX), "StateCount out of range!");
+  static_assert(EventCount > 0, "EventCount must be greater than 0!");
+  static_assert((STATEFORGE_MAX_DEPTH > 0) && (STATEFORGE_MAX_DEPTH <= UINT8_MAX),
+    "STATEFORGE_MAX_DEPTH must be between 1 and 255!");
+
+  public:
+  using State           = StateType;
+  using Event           = EventType;
+  using ContextPointer  = ContextType*;
+  using TransitionType  = Transition<StateType, EventType, Hook, ContextType>;
+  using DescriptorType  = StateDescriptor<StateType, EventType, Hook, ContextType>;
+  using TransitionTable = typename Storage::template Container<TransitionType>;
+  using ParentType      = StateParent<StateType>;
+
+  static constexpr size_t kStateCount = StateCount;
+
+  // Last active innermost state under each state, as of its last exit
+  struct Memory {
+    Memory() {
+      for (auto& state : last)
+        state = kNone;
+    }
+
+    uint16_t last[StateCount];
+  };
+
+  HierarchicalDefinition(StateType initial_state, std::initializer_list<ParentType> parents,
+    std::initializer_list<TransitionType> transitions)
+      : HierarchicalDefinition(initial_state, parents, {}, transitions) {}
+
+  HierarchicalDefinition(StateType initial_state, std::initializer_list<ParentType> parents,
+    std::initializer_list<DescriptorType> states, std::initializer_list<TransitionType> transitions)
+      : _initial_state(initial_state)
+      , _states(states)
+      , _transitions(transitions) {
+    build(parents.begin(), parents.end());
+  }
+
+  // Required by BufferStorage, the descriptors and transitions are not copied and must outlive the
+  // definition
+  HierarchicalDefinition(StateType initial_state, const ParentType* parents, size_t parent_count,
+    const TransitionType* transitions, size_t count)
+      : HierarchicalDefinition(initial_state,
+          parents,
+          parent_count,
+          nullptr,
+          0,
+          transitions,
+          count) {}
+
+  HierarchicalDefinition(StateType initial_state, const ParentType* parents, size_t parent_count,
+    const DescriptorType* states, size_t state_count, const TransitionType* transitions,
+    size_t count)
+      : _initial_state(initial_state)
+      , _states(states, states + state_count)
+      , _transitions(transitions, transitions + count) {
+    build(parents, parents + parent_count);
+  }
+
+  ~HierarchicalDefinition()                                        = default;
+  HierarchicalDefinition(const HierarchicalDefinition&)            = delete;
+  HierarchicalDefinition& operator=(const HierarchicalDefinition&) = delete;
+  HierarchicalDefinition(HierarchicalDefinition&&)                 = delete;
+  HierarchicalDefinition& operator=(HierarchicalDefinition&&)      = delete;
+
+  StateType getInitialState() const { return _initial_state; }
+
+  // The transition table as declared, e.g. for a GraphExporter
+  const TransitionTable& getTransitions() const { return _transitions; }
+
+  // True when state is ancestor or state itself
+  bool isWithin(StateType state, StateType ancestor) const {
+    const size_t s = static_cast<size_t>(state);
+    const size_t a = static_cast<size_t>(ancestor);
+    if ((s >= StateCount) || (a >= StateCount)) return false;
+
+    return (_depth[a] <= _depth[s]) && (_path[s][_depth[a]] == a);
+  }
+
+  // Same contract as MachineDefinition::step(); state is the current (innermost) state
+  TranResult step(StateType& state, EventType event) const {
+    NoMonitor monitor;
+    return step(state, event, monitor);
+  }
+
+  // Every hook run along the exit and enter paths is timed
+  template <typename Monitor>
+  TranResult step(StateType& state, EventType event, Monitor& monitor) const {
+    return run(state, event, monitor, nullptr);
+  }
+
+  // Same, resuming history pseudo-states from memory and recording the exited states in it
+  template <typename Monitor>
+  TranResult step(StateType& state, EventType event, Monitor& monitor, Memory& memory) const {
+    return run(state, event, monitor, &memory);
+  }
+
+  // Same contract as MachineDefinition::classify(), Direct only when no hook runs on the path
+  TransitionKind classify(StateType state, EventType event, StateType& next) const {
+    const size_t slot = slotOf(state, event);
+    if (slot == detail::kNoTransition) return TransitionKind::Missing;
+
+    const auto& transition = _transitions[_slots[slot]];
+    const size_t leaf      = static_cast<size_t>(state);
+    const size_t target    = static_cast<size_t>(transition.to);
+    const size_t source =
+      detail::isAny(transition.from) ? leaf : static_cast<size_t>(transition.from);
+
+    if (transition.guard || transition.on_transition) return TransitionKind::Hooked;
+    if (_history[target] != HistoryKind::None) return TransitionKind::Hooked;
+
+    for (size_t depth = _depth[leaf] + 1; depth-- > _domain[slot];) {
+      const uint16_t exited = _path[leaf][depth];
+      if ((exited == source) && transition.on_exit) return TransitionKind::Hooked;
+      if (hasExit(exited, exited == source)) return TransitionKind::Hooked;
+    }
+
+    for (size_t depth = _domain[slot]; depth <= _depth[target]; depth++) {
+      if (hasEnter(_path[target][depth])) return TransitionKind::Hooked;
+    }
+
+    next = transition.to;
+    return TransitionKind::Direct;
+  }
+
+  // Index of the timed transition of state or of its nearest ancestor, as in getTimeout()
+  size_t findTimed(StateType state) const {
+    const size_t s = static_cast<size_t>(state);
+    return ((s >= StateCount) || (_timed[s] == kNone)) ? detail::kNoTransition : _timed[s];
+  }
+
+  // Timed transition of state, or of its nearest ancestor when it has none
+  uint32_t getTimeout(StateType state, EventType& event) const {
+    const size_t s = static_cast<size_t>(state);
+    if ((s >= StateCount) || (_timed[s] == kNone)) return 0;
+
+    event = _transitions[_timed[s]].event;
+    return _transitions[_timed[s]].after;
+  }
+
+  // History pseudo-states are not states the machine can be in
+  bool hasState(StateType state) const {
+    const size_t s = static_cast<size_t>(state);
+    return (s < StateCount) && (_history[s] == HistoryKind::None);
+  }
+
+  // Same checks as MachineDefinition::validate(); a transition of a parent fires from its children
+  TableCheck validate() const {
+    const size_t dropped = detail::firstDropped(_transitions, kNone);
+    if (dropped != detail::kNoTransition) return {TableIssue::Overflow, dropped};
+
+    return detail::checkTable(_transitions, _initial_state, StateCount, [this](StateType state) {
+      const size_t s   = static_cast<size_t>(state);
+      uint64_t lineage = 0;
+      for (size_t depth = 0; depth <= _depth[s]; depth++)
+        lineage |= detail::bitOf(static_cast<StateType>(_path[s][depth]));
+      return lineage;
+    });
+  }
+
+  // Runs the enter hooks from the root down to state, with any<EventType>() as event
+  void enterState(StateType state) const {
+    const size_t s = static_cast<size_t>(state);
+    if (s >= StateCount) return;
+
+    NoMonitor monitor;
+    for (size_t depth = 0; depth <= _depth[s]; depth++)
+      enter(_path[s][depth], state, any<EventType>(), state, monitor, detail::kNoTransition);
+  }
+
+  // Whether state or one of its ancestors matches event, guards not evaluated
+  bool accepts(StateType state, EventType event) const {
+    return slotOf(state, event) != detail::kNoTransition;
+  }
+
+  // Whether some transition may fire for event, any event wildcards included; a linear scan
+  bool handles(EventType event) const {
+    for (const auto& transition : _transitions) {
+      if ((transition.event == event) || detail::isAny(transition.event)) return true;
+    }
+
+    return false;
+  }
+
+  ContextType* getContext(StateType from, EventType event, StateType to) const {
+    for (const auto& transition : _transitions) {
+      if ((transition.from == from) && (transition.event == event) && (transition.to == to)) {
+        return transition.context;
+      }
+    }
+
+    return nullptr;
+  }
+
+  private:
+  static constexpr uint16_t kNone   = UINT16_MAX;
+  static constexpr size_t kMaxDepth = STATEFORGE_MAX_DEPTH;
+
+  size_t slotOf(StateType state, EventType event) const {
+    const size_t s = static_cast<size_t>(state);
+    const size_t e = static_cast<size_t>(event);
+    if ((s >= StateCount) || (e >= EventCount)) return detail::kNoTransition;
+
+    const size_t slot = s * EventCount + e;
+    return _slots[slot] == kNone ? detail::kNoTransition : slot;
+  }
+
+  // Exact (from, event) entry, with an existing target
+  bool isValid(const TransitionType& transition) const {
+    return (static_cast<size_t>(transition.from) < StateCount) &&
+           (static_cast<size_t>(transition.to) < StateCount) &&
+           (static_cast<size_t>(transition.event) < EventCount);
+  }
+
+  // Depth of the deepest common proper ancestor of a and b, plus one (0: none)
+  uint8_t domainOf(size_t a, size_t b) const {
+    uint8_t domain = 0;
+    while ((domain < _depth[a]) && (domain < _depth[b]) && (_path[a][domain] == _path[b][domain]))
+      domain++;
+
+    return domain;
+  }
+
+  template <typename Monitor>
+  TranResult run(StateType& state, EventType event, Monitor& monitor, Memory* memory) const {
+    const size_t slot = slotOf(state, event);
+    if (slot == detail::kNoTransition) {
+      monitor.onNotFound(static_cast<size_t>(state), static_cast<size_t>(event));
+      return TranResult::NotFound;
+    }
+
+    const size_t match = detail::firstEnabled(_transitions, _slots[slot], state, event, StateCount);
+    if (match == detail::kNoTransition) return TranResult::NoChange;
+
+    monitor.onTransition(match);
+
+    const auto& transition = _transitions[match];
+    const size_t leaf      = static_cast<size_t>(state);
+    const Trigger trigger  = {
+      detail::isAny(transition.from) ? state : transition.from,
+      detail::isAny(transition.event) ? event : transition.event,
+      match,
+      transition,
+    };
+
+    TranResult result = TranResult::Change;
+    if (transition.on_transition) {
+      const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Transition);
+      result =
+        transition.on_transition(trigger.from, trigger.event, transition.to, transition.context);
+    }
+
+    // Same rules as the flat machine: Reset heads to the initial state instead of the target
+    const bool reset     = result == TranResult::Reset;
+    const StateType next = reset ? _initial_state : resume(transition.to, memory);
+    const size_t target  = static_cast<size_t>(next);
+    const size_t source  = static_cast<size_t>(trigger.from);
+
+    // Only the first candidate of the slot has its domain precomputed, for its declared target
+    const bool declared  = (match == _slots[slot]) && (next == transition.to);
+    const uint8_t domain = reset      ? _reset_domain[source]
+                           : declared ? _domain[slot]
+                                      : domainOf(source, target);
+
+    for (size_t depth = _depth[leaf] + 1; depth-- > domain;) {
+      if (memory && (depth < _depth[leaf])) memory->last[_path[leaf][depth]] = leaf;
+      exit(_path[leaf][depth], trigger, monitor);
+    }
+
+    for (size_t depth = domain; depth <= _depth[target]; depth++)
+      enter(_path[target][depth], trigger, monitor);
+
+    switch (result) {
+      case TranResult::Change: state = next; return result;
+      case TranResult::Reset: state = _initial_state; return result;
+      default: return result;
+    }
+  }
+
+  // State a transition to state enters: for a history pseudo-state, the child (Shallow) or
+  // innermost state (Deep) memory last saw active under its parent, or else the parent
+  StateType resume(StateType state, const Memory* memory) const {
+    const size_t pseudo = static_cast<size_t>(state);
+    if ((pseudo >= StateCount) || (_history[pseudo] == HistoryKind::None)) return state;
+
+    const size_t parent = _path[pseudo][_depth[pseudo] - 1];
+    const size_t last   = memory ? memory->last[parent] : kNone;
+    if (last == kNone) return static_cast<StateType>(parent);
+
+    return static_cast<StateType>(
+      _history[pseudo] == HistoryKind::Deep ? last : _path[last][_depth[parent] + 1]);
+  }
+
+  // Taken transition, with wildcards replaced by the actual source state and event
+  struct Trigger {
+    StateType from;
+    EventType event;
+    size_t index;
+    const TransitionType& transition;
+  };
+
+  const DescriptorType* descriptorOf(size_t state) const {
+    return detail::descriptorOf(_states, static_cast<StateType>(state));
+  }
+
+  // Whether exiting state runs a hook besides the on_exit of the taken transition
+  bool hasExit(size_t state, bool source) const {
+    if (_states.size() == 0) return !source && (_exit[state] != kNone);
+
+    const DescriptorType* descriptor = descriptorOf(state);
+    return descriptor && descriptor->on_exit;
+  }
+
+  bool hasEnter(size_t state) const {
+    if (_states.size() == 0) return _enter[state] != kNone;
+
+    const DescriptorType* descriptor = descriptorOf(state);
+    return descriptor && descriptor->on_enter;
+  }
+
+  template <typename Monitor>
+  void exit(size_t state, const Trigger& trigger, Monitor& monitor) const {
+    const auto& transition = trigger.transition;
+    const bool source      = state == static_cast<size_t>(trigger.from);
+
+    if (source && transition.on_exit) {
+      const detail::HookTimer<Monitor> timer(monitor, trigger.index, HookStage::Exit);
+      transition.on_exit(trigger.from, trigger.event, transition.to, transition.context);
+    }
+
+    if (!hasExit(state, source)) return;
+
+    const detail::HookTimer<Monitor> timer(monitor, trigger.index, HookStage::Exit);
+    if (_states.size() > 0) {
+      const DescriptorType* descriptor = descriptorOf(state);
+      descriptor->on_exit(trigger.from, trigger.event, transition.to, descriptor->context);
+    } else {
+      const auto& exit_transition = _transitions[_exit[state]];
+      exit_transition.on_exit(trigger.from, trigger.event, transition.to, exit_transition.context);
+    }
+  }
+
+  template <typename Monitor>
+  void enter(size_t state, const Trigger& trigger, Monitor& monitor) const {
+    enter(state, trigger.from, trigger.event, trigger.transition.to, monitor, trigger.index);
+  }
+
+  template <typename Monitor>
+  void enter(size_t state, StateType from, EventType event, StateType to, Monitor& monitor,
+    size_t index) const {
+    if (!hasEnter(state)) return;
+
+    const detail::HookTimer<Monitor> timer(monitor, index, HookStage::Enter);
+    if (_states.size() > 0) {
+      const DescriptorType* descriptor = descriptorOf(state);
+      descriptor->on_enter(from, event, to, descriptor->context);
+    } else {
+      const auto& transition = _transitions[_enter[state]];
+      transition.on_enter(from, event, to, transition.context);
+    }
+  }
+
+  template <typename ParentIterator>
+  void build(ParentIterator first, ParentIterator last) {
+    uint16_t parent[StateCount];
+    for (auto& entry : parent)
+      entry = kNone;
+
+    for (auto& kind : _history)
+      kind = HistoryKind::None;
+
+    for (; first != last; ++first) {
+      const size_t state = static_cast<size_t>(first->state);
+      const size_t up    = static_cast<size_t>(first->parent);
+      if ((state >= StateCount) || (up >= StateCount) || (state == up)) continue;
+
+      parent[state]   = static_cast<uint16_t>(up);
+      _history[state] = first->history;
+    }
+
+    // Root-to-state paths; chains that loop or are too deep are cut to keep the state top-level
+    for (size_t state = 0; state < StateCount; state++) {
+      uint16_t chain[kMaxDepth];
+      size_t length = 0;
+
+      for (size_t cursor = state; cursor != kNone; cursor = parent[cursor]) {
+        if (length == kMaxDepth) {
+          chain[0] = static_cast<uint16_t>(state);
+          length   = 1;
+          break;
+        }
+
+        chain[length++] = static_cast<uint16_t>(cursor);
+      }
+
+      _depth[state] = static_cast<uint8_t>(length - 1);
+      for (size_t depth = 0; depth < length; depth++)
+        _path[state][depth] = chain[length - 1 - depth];
+
+      // A history pseudo-state kept top-level has no parent to resume
+      if (_depth[state] == 0) _history[state] = HistoryKind::None;
+    }
+
+    for (auto& slot : _slots)
+      slot = kNone;
+    for (size_t state = 0; state < StateCount; state++)
+      _enter[state] = _exit[state] = _timed[state] = kNone;
+
+    // Own transitions first, keeping the first match as the flat machines do
+    for (size_t i = 0; (i < _transitions.size()) && (i < kNone); i++) {
+      const auto& transition = _transitions[i];
+      const size_t state     = static_cast<size_t>(transition.from);
+      if (state >= StateCount) continue;
+
+      if (transition.on_enter && (_enter[state] == kNone)) _enter[state] = static_cast<uint16_t>(i);
+      if (transition.on_exit && (_exit[state] == kNone)) _exit[state] = static_cast<uint16_t>(i);
+
+      if (!isValid(transition)) continue;
+
+      if ((transition.after > 0) && (_timed[state] == kNone))
+        _timed[state] = static_cast<uint16_t>(i);
+
+      uint16_t& slot = _slots[state * EventCount + static_cast<size_t>(transition.event)];
+      if (slot == kNone) slot = static_cast<uint16_t>(i);
+    }
+
+    // Then (state, any event), inherited unhandled events from the parent, shallow states first,
+    // and finally the any state wildcards
+    detail::fillAnyEvent(_transitions, _slots, StateCount, EventCount);
+
+    for (size_t depth = 1; depth < kMaxDepth; depth++) {
+      for (size_t state = 0; state < StateCount; state++) {
+        if (_depth[state] != depth) continue;
+
+        const size_t up = _path[state][depth - 1];
+        for (size_t event = 0; event < EventCount; event++) {
+          uint16_t& slot = _slots[state * EventCount + event];
+          if (slot == kNone) slot = _slots[up * EventCount + event];
+        }
+
+        if (_timed[state] == kNone) _timed[state] = _timed[up];
+      }
+    }
+
+    detail::fillAnyState(_transitions, _slots, StateCount, EventCount);
+
+    // Slots pointing to a missing target are dropped
+    for (size_t slot = 0; slot < StateCount * EventCount; slot++) {
+      if (_slots[slot] == kNone) continue;
+
+      const auto& transition = _transitions[_slots[slot]];
+      const size_t target    = static_cast<size_t>(transition.to);
+      const size_t source    = detail::isAny(transition.from)
+                                   ? slot / EventCount
+                                   : static_cast<size_t>(transition.from);
+
+      if (target >= StateCount)
+        _slots[slot] = kNone;
+      else
+        _domain[slot] = domainOf(source, target);
+    }
+
+    const size_t initial = static_cast<size_t>(_initial_state) < StateCount
+                             ? static_cast<size_t>(_initial_state)
+                             : 0;
+    for (size_t state = 0; state < StateCount; state++)
+      _reset_domain[state] = domainOf(state, initial);
+  }
+
+  StateType _initial_state;
+  typename Storage::template Container<DescriptorType> _states;
+  TransitionTable _transitions;
+
+  uint16_t _slots[StateCount * EventCount];
+  uint8_t _domain[StateCount * EventCount];
+  uint16_t _enter[StateCount];
+  uint16_t _exit[StateCount];
+  uint16_t _timed[StateCount];
+  uint16_t _path[StateCount][kMaxDepth];
+  uint8_t _depth[StateCount];
+  uint8_t _reset_domain[StateCount];
+  HistoryKind _history[StateCount];
+};
+
+template <typename StateType, typename EventType, size_t StateCount, size_t EventCount,
+  template <typename> class Hook = std::function, typename Storage = HeapStorage,
+  typename Monitor = NoMonitor, typename ContextType = Context>
+class HierarchicalStateMachine
+    : public BasicStateMachine<HierarchicalDefinition<StateType, EventType, StateCount,
+                                 EventCount, Hook, Storage, ContextType>,
+        Monitor> {
+  using Base = BasicStateMachine<HierarchicalDefinition<StateType, EventType, StateCount,
+                                   EventCount, Hook, Storage, ContextType>,
+    Monitor>;
+
+  public:
+  using Definition = HierarchicalDefinition<StateType, EventType, StateCount, EventCount, Hook,
+    Storage, ContextType>;
+  using TransitionType = typename Definition::TransitionType;
+  using DescriptorType = typename Definition::DescriptorType;
+  using ParentType     = typename Definition::ParentType;
+
+  HierarchicalStateMachine(StateType initial_state, std::initializer_list<ParentType> parents,
+    std::initializer_list<TransitionType> transitions)
+      : Base(initial_state, parents, transitions) {}
+
+  HierarchicalStateMachine(StateType initial_state, std::initializer_list<ParentType> parents,
+    std::initializer_list<DescriptorType> states, std::initializer_list<TransitionType> transitions)
+      : Base(initial_state, parents, states, transitions) {}
+
+  HierarchicalStateMachine(StateType initial_state, const ParentType* parents,
+    size_t parent_count, const TransitionType* transitions, size_t count)
+      : Base(initial_state, parents, parent_count, transitions, count) {}
+
+  HierarchicalStateMachine(StateType initial_state, const ParentType* parents,
+    size_t parent_count, const DescriptorType* states, size_t state_count,
+    const TransitionType* transitions, size_t count)
+      : Base(initial_state, parents, parent_count, states, state_count, transitions, count) {}
+
+  // True when the current state is state or one of its descendants
+  bool isInState(StateType state) {
+    return this->getDefinition().isWithin(this->getCurrentState(), state);
+  }
+};
+
+namespace detail {
+// Payload part of an EventQueue cell, empty for queues of plain events
+template <typename Payload>
+struct PayloadSlot {
+  Payload payload;
+  bool has_payload;
+
+  void clear() { has_payload = false; }
+
+  template <typename Machine, typename EventType>
+  TranResult dispatchTo(Machine& machine, EventType event) const {
+    return has_payload ? machine.dispatch(event, payload) : machine.dispatch(event);
+  }
+};
+
+template <>
+struct PayloadSlot<void> {
+  void clear() {}
+
+  template <typename Machine, typename EventType>
+  TranResult dispatchTo(Machine& machine, EventType event) const {
+    return machine.dispatch(event);
+  }
+};
+} // namespace detail
+
+/**
+ * Bounded lock-free event queue attached to a machine. post() may be called concurrently from any
+ * task or ISR: it never blocks and returns false when the queue is full. processPending() must only
+ * be called from the task that owns the machine, and dispatches the queued events in FIFO order.
+ * Capacity must be a power of 2. With a Payload type, each cell also holds a payload: post() copies
+ * it into the fixed cell storage, and the machine gets it by reference (see getPayload()) straight
+ * from there, without any allocation or further copy.
+ */
+template <typename Machine, size_t Capacity, typename Payload = void>
+class EventQueue {
+  static_assert((Capacity > 0) && ((Capacity & (Capacity - 1)) == 0),
+    "Capacity must be a power of 2!");
+
+  public:
+  using EventType = typename Machine::Event;
+
+  EventQueue(Machine& machine)
+      : _machine(machine)
+      , _head(0)
+      , _tail(0) {
+    for (size_t i = 0; i < Capacity; i++)
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  EventQueue(const EventQueue&)            = delete;
+  EventQueue& operator=(const EventQueue&) = delete;
+
+  bool post(EventType event) {
+    size_t position;
+    Cell* cell = claim(position);
+    if (cell == nullptr) return false;
+
+    cell->event = event;
+    cell->clear();
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <typename P = Payload>
+  typename std::enable_if<!std::is_void<P>::value, bool>::type post(EventType event,
+    const P& payload) {
+    size_t position;
+    Cell* cell = claim(position);
+    if (cell == nullptr) return false;
+
+    cell->event       = event;
+    cell->payload     = payload;
+    cell->has_payload = true;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Dispatches up to max_events queued events and returns how many were processed
+  size_t processPending(size_t max_events = SIZE_MAX) {
+    size_t processed = 0;
+
+    while (processed < max_events) {
+      const size_t head     = _head;
+      Cell& cell            = _cells[head & kMask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (static_cast<ptrdiff_t>(sequence - (head + 1)) < 0) break;
+
+      // Dispatched in place, so the cell is only handed back to producers afterwards
+      _head++;
+      cell.dispatchTo(_machine, cell.event);
+      cell.sequence.store(head + Capacity, std::memory_order_release);
+      processed++;
+    }
+
+    return processed;
+  }
+
+  /**
+   * Copies up to max queued events, oldest first, without removing them, e.g. to post them again
+   * after a restart. Owning task only, like processPending().
+   */
+  size_t peek(EventType* events, size_t max) const {
+    size_t count = 0;
+    for (; count < max; count++) {
+      const Cell& cell      = _cells[(_head + count) & kMask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (static_cast<ptrdiff_t>(sequence - (_head + count + 1)) < 0) break;
+
+      events[count] = cell.event;
+    }
+
+    return count;
+  }
+
+  bool isEmpty() const {
+    const Cell& cell = _cells[_head & kMask];
+    return static_cast<ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - (_head + 1)) < 0;
+  }
+
+  private:
+  static constexpr size_t kMask = Capacity - 1;
+
+  struct Cell : detail::PayloadSlot<Payload> {
+    std::atomic<size_t> sequence;
+    EventType event;
+  };
+
+  // Reserves the next free cell for a producer, or returns nullptr when the queue is full
+  Cell* claim(size_t& position) {
+    position = _tail.load(std::memory_order_relaxed);
+
+    for (;;) {
+      Cell* cell            = &_cells[position & kMask];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff       = static_cast<ptrdiff_t>(sequence - position);
+
+      if (diff == 0) {
+        // Claim the slot; on failure position is reloaded by compare_exchange
+        if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          return cell;
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        position = _tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  Machine& _machine;
+  Cell _cells[Capacity];
+  size_t _head;
+  std::atomic<size_t> _tail;
+};
+
+// How a PolicyQueue handles one event (see PolicyQueue::setPolicy())
+enum class EventPolicy : uint8_t {
+  Queue,    // Every post is queued and dispatched, the default
+  Coalesce, // Dropped while the same event is already queued, so the oldest payload is kept
+  Latest,   // Queued, but only the most recent of the pending ones is dispatched
+  Defer,    // Held back while the current state does not accept it, until one that does
+};
+
+/**
+ * EventQueue for high-rate event sources, with a per-event EventPolicy. Posting stays lock-free
+ * and ISR safe, and the same event posted in a burst costs one dispatch with Coalesce or Latest.
+ * Deferred events wait in a bounded list of Capacity entries, owned by the consumer task, and are
+ * dispatched in post order once a dispatch from the queue enters a state that accepts them; they
+ * are dropped when the list is full (see getDropped()). Which events each state accepts is looked
+ * up once at construction through the definition's accepts(), and events it rejects are skipped
+ * without any dispatch, so monitors never see their NotFound. Set the policies before posting.
+ *
+ * Usage:
+ *   PolicyQueue<decltype(sm), 16, 4, 6> queue(sm);
+ *   queue.setPolicy(Event::Sample, EventPolicy::Latest);
+ */
+template <typename Machine, size_t Capacity, size_t StateCount, size_t EventCount,
+  typename Payload = void>
+class PolicyQueue {
+  public:
+  using StateType = typename Machine::State;
+  using EventType = typename Machine::Event;
+
+  PolicyQueue(Machine& machine)
+      : _machine(machine)
+      , _sink{*this}
+      , _queue(_sink)
+      , _held_count(0)
+      , _dropped(0) {
+    for (size_t event = 0; event < EventCount; event++) {
+      _policies[event] = EventPolicy::Queue;
+      _phases[event].store(Idle, std::memory_order_relaxed);
+      _posted[event].store(0, std::memory_order_relaxed);
+      _taken[event] = 0;
+    }
+
+    for (size_t state = 0; state < StateCount; state++) {
+      for (size_t word = 0; word < kWords; word++)
+        _accepts[state][word] = 0;
+
+      for (size_t event = 0; event < EventCount; event++) {
+        if (machine.getDefinition().accepts(static_cast<StateType>(state),
+              static_cast<EventType>(event)))
+          _accepts[state][event / 32] |= uint32_t(1) << (event % 32);
+      }
+    }
+  }
+
+  PolicyQueue(const PolicyQueue&)            = delete;
+  PolicyQueue& operator=(const PolicyQueue&) = delete;
+
+  // Ignored for events past EventCount, which are always queued
+  void setPolicy(EventType event, EventPolicy policy) {
+    const size_t index = static_cast<size_t>(event);
+    if (index < EventCount) _policies[index] = policy;
+  }
+
+  EventPolicy getPolicy(EventType event) const {
+    const size_t index = static_cast<size_t>(event);
+    return index < EventCount ? _policies[index] : EventPolicy::Queue;
+  }
+
+  /**
+   * Returns true when queued or coalesced into a queued post, false when the queue is full. A
+   * Coalesce event also returns false while an earlier post of it is still being published, e.g.
+   * by a task this ISR preempted, as that post may yet find the queue full.
+   */
+  bool post(EventType event) {
+    const size_t index        = static_cast<size_t>(event);
+    const Admission admission = admit(index);
+    if (admission != Admission::Post) return admission == Admission::Coalesced;
+
+    if (!_queue.post(event)) return reject(index);
+
+    published(index);
+    return true;
+  }
+
+  template <typename P = Payload>
+  typename std::enable_if<!std::is_void<P>::value, bool>::type post(EventType event,
+    const P& payload) {
+    const size_t index        = static_cast<size_t>(event);
+    const Admission admission = admit(index);
+    if (admission != Admission::Post) return admission == Admission::Coalesced;
+
+    if (!_queue.post(event, payload)) return reject(index);
+
+    published(index);
+    return true;
+  }
+
+  // Takes up to max_events posts off the queue, skipped and deferred ones included
+  size_t processPending(size_t max_events = SIZE_MAX) { return _queue.processPending(max_events); }
+
+  // Deferred events are not counted
+  bool isEmpty() const { return _queue.isEmpty(); }
+
+  // Deferred events waiting for a state that accepts them
+  size_t getHeld() const { return _held_count; }
+
+  // Deferred events dropped because the list was full
+  size_t getDropped() const { return _dropped; }
+
+  // Whether the definition has a transition for event from state, guards not evaluated
+  bool accepts(StateType state, EventType event) const {
+    const size_t s = static_cast<size_t>(state);
+    const size_t e = static_cast<size_t>(event);
+    if ((s >= StateCount) || (e >= EventCount)) return true; // Left to the machine
+
+    return (_accepts[s][e / 32] >> (e % 32)) & 1;
+  }
+
+  private:
+  static constexpr size_t kWords = (EventCount + 31) / 32;
+
+  // Phase of a Coalesce event. The post admitted from Idle moves it to Posting, then to Queued once
+  // its cell is published. Receiving the cell moves it back to Idle, or to Received when that post
+  // has yet to mark it Queued, which then moves it to Idle itself. Only Queued coalesces.
+  enum Phase : uint32_t { Idle, Posting, Queued, Received };
+
+  enum class Admission : uint8_t { Post, Coalesced, Busy };
+
+  // Machine as seen by the inner queue: every dequeued post goes through receive()
+  struct Sink {
+    using Event = EventType;
+
+    PolicyQueue& queue;
+
+    TranResult dispatch(EventType event) {
+      return queue.receive(event, static_cast<const Payload*>(nullptr));
+    }
+
+    template <typename P>
+    TranResult dispatch(EventType event, const P& payload) {
+      return queue.receive(event, &payload);
+    }
+  };
+
+  struct Held : detail::PayloadSlot<Payload> {
+    EventType event;
+  };
+
+  bool coalesces(size_t index) const {
+    return (index < EventCount) && (_policies[index] == EventPolicy::Coalesce);
+  }
+
+  Admission admit(size_t index) {
+    if (!coalesces(index)) return Admission::Post;
+
+    uint32_t phase = Idle;
+    if (_phases[index].compare_exchange_strong(phase, Posting, std::memory_order_acq_rel))
+      return Admission::Post;
+
+    return phase == Queued ? Admission::Coalesced : Admission::Busy;
+  }
+
+  // Nothing of the event is queued while it is Posting, so no other post or receive can move it
+  bool reject(size_t index) {
+    if (coalesces(index)) _phases[index].store(Idle, std::memory_order_release);
+    return false;
+  }
+
+  // Marked or counted once the cell is published, so a consumer seeing either also sees the cell
+  void published(size_t index) {
+    if (coalesces(index)) {
+      uint32_t phase = Posting;
+      if (!_phases[index].compare_exchange_strong(phase, Queued, std::memory_order_acq_rel))
+        _phases[index].store(Idle, std::memory_order_release); // Received meanwhile
+    } else if ((index < EventCount) && (_policies[index] == EventPolicy::Latest)) {
+      _posted[index].fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  template <typename P>
+  TranResult receive(EventType event, const P* payload) {
+    const size_t index       = static_cast<size_t>(event);
+    const EventPolicy policy = getPolicy(event);
+
+    if (policy == EventPolicy::Coalesce) {
+      // Left before dispatching, so a post from now on is a new one. The owning post may mark it
+      // Queued meanwhile, so retried on the phase found
+      uint32_t phase = Queued;
+      while (!_phases[index].compare_exchange_weak(phase, (phase == Posting) ? Received : Idle,
+        std::memory_order_acq_rel)) {}
+    } else if (policy == EventPolicy::Latest) {
+      // Superseded when a later post of the same event is already in the queue
+      if (++_taken[index] < _posted[index].load(std::memory_order_acquire))
+        return TranResult::NoChange;
+    }
+
+    if (!accepts(_machine.getCurrentState(), event)) {
+      if (policy == EventPolicy::Defer) hold(event, payload);
+      return TranResult::NotFound;
+    }
+
+    const StateType before  = _machine.getCurrentState();
+    const TranResult result = deliver(event, payload);
+    if ((_held_count > 0) && (_machine.getCurrentState() != before)) release();
+
+    return result;
+  }
+
+  void hold(EventType event, const Payload* payload) {
+    if (_held_count == Capacity) {
+      _dropped++;
+      return;
+    }
+
+    Held& held = _held[_held_count++];
+    held.event = event;
+    store(held, payload);
+  }
+
+  // Dispatches the held events the current state accepts, oldest first, rescanning on each change
+  void release() {
+    size_t i = 0;
+    while (i < _held_count) {
+      if (!accepts(_machine.getCurrentState(), _held[i].event)) {
+        i++;
+        continue;
+      }
+
+      // Copied out first, as the dispatch may hold further events
+      const Held held = _held[i];
+      for (size_t j = i + 1; j < _held_count; j++)
+        _held[j - 1] = _held[j];
+      _held_count--;
+
+      const StateType before = _machine.getCurrentState();
+      held.dispatchTo(_machine, held.event);
+      if (_machine.getCurrentState() != before) i = 0;
+    }
+  }
+
+  template <typename P>
+  TranResult deliver(EventType event, const P* payload) {
+    return payload ? _machine.dispatch(event, *payload) : _machine.dispatch(event);
+  }
+
+  TranResult deliver(EventType event, const void*) { return _machine.dispatch(event); }
+
+  template <typename P>
+  static void store(detail::PayloadSlot<P>& slot, const P* payload) {
+    slot.has_payload = payload != nullptr;
+    if (payload) slot.payload = *payload;
+  }
+
+  static void store(detail::PayloadSlot<void>&, const void*) {}
+
+  Machine& _machine;
+  Sink _sink;
+  EventQueue<Sink, Capacity, Payload> _queue;
+  EventPolicy _policies[EventCount];
+  uint32_t _accepts[StateCount][kWords];
+  std::atomic<uint32_t> _phases[EventCount];
+  std::atomic<size_t> _posted[EventCount];
+  size_t _taken[EventCount];
+  Held _held[Capacity];
+  size_t _held_count;
+  size_t _dropped;
+};
+
+namespace detail {
+struct TimerLink {
+  TimerLink* prev;
+  TimerLink* next;
+};
+} // namespace detail
+
+/**
+ * Hierarchical timing wheel shared by any number of timers: 4 levels of 64 slots, advanced by
+ * tick(now), with now in any unit (e.g. millis()) that may wrap around. Timers are nodes owned by
+ * the caller, so arming and cancelling are O(1) list operations without allocation. Delays are
+ * exact up to 2^24 - 1 ticks and clamped beyond. Arm, cancel and tick from the same task.
+ */
+class TimerWheel {
+  public:
+  using Callback = void (*)(void* target);
+
+  // Calls callback(target) when it expires; cancelled on destruction
+  class Timer : private detail::TimerLink {
+    public:
+    Timer(Callback callback, void* target)
+        : TimerLink{nullptr, nullptr}
+        , _wheel(nullptr)
+        , _expires(0)
+        , _callback(callback)
+        , _target(target) {}
+
+    ~Timer() { cancel(); }
+
+    Timer(const Timer&)            = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    bool isArmed() const { return _wheel != nullptr; }
+
+    // Ticks left until expiry, 0 when not armed
+    uint32_t remaining() const { return isArmed() ? _expires - _wheel->_now : 0; }
+
+    void cancel() {
+      if (!isArmed()) return;
+
+      prev->next = next;
+      next->prev = prev;
+      prev = next = nullptr;
+
+      _wheel->_armed--;
+      _wheel = nullptr;
+    }
+
+    private:
+    friend class TimerWheel;
+
+    TimerWheel* _wheel;
+    uint32_t _expires;
+    Callback _callback;
+    void* _target;
+  };
+
+  static constexpr size_t kLevels     = 4;
+  static constexpr size_t kSlotBits   = 6;
+  static constexpr uint32_t kMaxDelay = (1u << (kLevels * kSlotBits)) - 1;
+
+  explicit TimerWheel(uint32_t now = 0)
+      : _now(now)
+      , _armed(0) {
+    for (auto& level : _slots) {
+      for (auto& slot : level)
+        slot.prev = slot.next = &slot;
+    }
+  }
+
+  TimerWheel(const TimerWheel&)            = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  uint32_t now() const { return _now; }
+  size_t armedCount() const { return _armed; }
+
+  // (Re)arms timer to expire delay ticks from now(), at least one
+  void arm(Timer& timer, uint32_t delay) {
+    timer.cancel();
+    if (delay == 0) delay = 1;
+    if (delay > kMaxDelay) delay = kMaxDelay;
+
+    timer._expires = _now + delay;
+    timer._wheel   = this;
+    _armed++;
+    insert(timer);
+  }
+
+  /**
+   * Advances to now and fires every timer due meanwhile, in expiry order, and returns how many.
+   * Callbacks may arm and cancel timers. A now behind now() is ignored.
+   */
+  size_t tick(uint32_t now) {
+    size_t fired = 0;
+
+    while (static_cast<int32_t>(now - _now) > 0) {
+      if (_armed == 0) {
+        _now = now;
+        break;
+      }
+
+      _now++;
+      cascade();
+
+      detail::TimerLink& slot = _slots[0][_now & kSlotMask];
+      while (slot.next != &slot) {
+        Timer& timer = *static_cast<Timer*>(slot.next);
+        timer.cancel();
+        timer._callback(timer._target);
+        fired++;
+      }
+    }
+
+    return fired;
+  }
+
+  private:
+  static constexpr size_t kSlots      = size_t(1) << kSlotBits;
+  static constexpr uint32_t kSlotMask = kSlots - 1;
+
+  // Level k holds the timers due in less than 64^(k + 1) ticks, in slots of 64^k ticks
+  void insert(Timer& timer) {
+    const uint32_t delta = timer._expires - _now;
+
+    size_t level = 0;
+    while ((level + 1 < kLevels) && (delta >> (kSlotBits * (level + 1))) != 0)
+      level++;
+
+    detail::TimerLink& slot = _slots[level][(timer._expires >> (kSlotBits * level)) & kSlotMask];
+    timer.prev              = slot.prev;
+    timer.next              = &slot;
+    slot.prev->next         = &timer;
+    slot.prev               = &timer;
+  }
+
+  // Moves the slot of each upper level that just came due one level down, when the level below
+  // wraps around
+  void cascade() {
+    for (size_t level = 1; level < kLevels; level++) {
+      if (((_now >> (kSlotBits * (level - 1))) & kSlotMask) != 0) break;
+
+      detail::TimerLink& slot = _slots[level][(_now >> (kSlotBits * level)) & kSlotMask];
+      detail::TimerLink* node = slot.next;
+      slot.prev = slot.next = &slot;
+
+      while (node != &slot) {
+        Timer& timer = *static_cast<Timer*>(node);
+        node         = node->next;
+        insert(timer);
+      }
+    }
+  }
+
+  uint32_t _now;
+  size_t _armed;
+  detail::TimerLink _slots[kLevels][kSlots];
+};
+
+/**
+ * Runs the timed transitions of a machine (see Transition::after) on a shared TimerWheel.
+ * Dispatch through it rather than through the machine: whenever a dispatch returns Reset, returns
+ * Change without leaving the state, or leaves the machine in a state timed by another transition,
+ * the pending timeout is cancelled and the one of the current state, if any, is armed. Moving
+ * between children of a composite that owns the timeout keeps it running. On expiry its event is
+ * dispatched like any other.
+ */
+template <typename Machine>
+class MachineTimer {
+  public:
+  using State = typename Machine::State;
+  using Event = typename Machine::Event;
+
+  MachineTimer(TimerWheel& wheel, Machine& machine)
+      : _wheel(wheel)
+      , _machine(machine)
+      , _timer(onExpire, this)
+      , _event()
+      , _owner(detail::kNoTransition) {}
+
+  MachineTimer(const MachineTimer&)            = delete;
+  MachineTimer& operator=(const MachineTimer&) = delete;
+
+  // Arms the timeout of the current state, at startup or after the machine was reset
+  void start() { arm(); }
+
+  void stop() {
+    _timer.cancel();
+    _owner = detail::kNoTransition;
+  }
+
+  bool isArmed() const { return _timer.isArmed(); }
+
+  // Machine snapshot plus the ticks left on its timeout, 0 when none is pending
+  struct Snapshot {
+    typename Machine::Snapshot machine;
+    uint32_t remaining;
+  };
+
+  Snapshot snapshot() const { return {_machine.snapshot(), _timer.remaining()}; }
+
+  /**
+   * Restores the machine (see BasicStateMachine::restore()), then re-arms the timeout of its state
+   * with the remaining ticks, counted from the wheel's now() which may belong to a new boot.
+   */
+  bool restore(const Snapshot& snapshot, bool enter = false) {
+    if (!_machine.restore(snapshot.machine, enter)) return false;
+
+    _timer.cancel();
+    _owner = detail::kNoTransition;
+    if (snapshot.remaining == 0) return true;
+
+    Event event;
+    if (_machine.getDefinition().getTimeout(_machine.getCurrentState(), event) == 0) return true;
+
+    _owner = _machine.getDefinition().findTimed(_machine.getCurrentState());
+    _event = event;
+    _wheel.arm(_timer, snapshot.remaining);
+    return true;
+  }
+
+  TranResult dispatch(Event event) {
+    const State before      = _machine.getCurrentState();
+    const TranResult result = _machine.dispatch(event);
+    const State after       = _machine.getCurrentState();
+
+    if ((result == TranResult::Reset) || ((result == TranResult::Change) && (after == before)) ||
+        ((after != before) && (_machine.getDefinition().findTimed(after) != _owner)))
+      arm();
+
+    return result;
+  }
+
+  private:
+  static void onExpire(void* target) {
+    MachineTimer& self = *static_cast<MachineTimer*>(target);
+    self.dispatch(self._event);
+  }
+
+  void arm() {
+    _timer.cancel();
+    _owner = _machine.getDefinition().findTimed(_machine.getCurrentState());
+
+    Event event;
+    const uint32_t after = _machine.getDefinition().getTimeout(_machine.getCurrentState(), event);
+    if (after == 0) return;
+
+    _event = event;
+    _wheel.arm(_timer, after);
+  }
+
+  TimerWheel& _wheel;
+  Machine& _machine;
+  TimerWheel::Timer _timer;
+  Event _event;
+  size_t _owner; // Timed transition the timer runs for, detail::kNoTransition when none
+};
+
+namespace detail {
+template <typename First, typename...>
+struct Front {
+  using type = First;
+};
+} // namespace detail
+
+/**
+ * Orthogonal regions: independent machines (StateMachine, IndexedStateMachine or
+ * HierarchicalStateMachine) over the same event type, driven by a single dispatch(). The regions
+ * are owned by the caller. An event is only offered to the regions whose table handles it, through
+ * an event to region mask built once at construction, and events past EventCount or handled by no
+ * region return NotFound without touching any of them. Up to 32 regions.
+ *
+ * Usage:
+ *   ParallelMachine<3, decltype(power), decltype(radio)> system(power, radio);
+ */
+template <size_t EventCount, typename... Regions>
+class ParallelMachine {
+  static_assert((sizeof...(Regions) > 0) && (sizeof...(Regions) <= 32),
+    "ParallelMachine takes from 1 to 32 regions!");
+
+  public:
+  using Event = typename detail::Front<Regions...>::type::Event;
+
+  static constexpr size_t kRegionCount = sizeof...(Regions);
+
+  ParallelMachine(Regions&... regions)
+      : _regions{{&regions, &dispatchTo<Regions>}...} {
+    for (auto& routes : _routes)
+      routes = 0;
+
+    size_t region      = 0;
+    const int expand[] = {(route(regions, region++), 0)...};
+    (void)expand;
+  }
+
+  ParallelMachine(const ParallelMachine&)            = delete;
+  ParallelMachine& operator=(const ParallelMachine&) = delete;
+
+  /**
+   * Offers event to each region that handles it, in declaration order, and returns the set of
+   * their results. A region dispatching to the composite from a hook gets Deferred (or Overflow)
+   * and the event runs once the current one has been offered to every region.
+   */
+  ResultMask dispatch(Event event) {
+    if (_rtc.isBusy()) return _rtc.push(event) ? TranResult::Deferred : TranResult::Overflow;
+
+    _rtc.setBusy(true);
+    const ResultMask results = process(event);
+
+    Event deferred;
+    while (_rtc.pop(deferred))
+      process(deferred);
+
+    _rtc.setBusy(false);
+    return results;
+  }
+
+  // Bit r is set when region r handles event
+  uint32_t getRoutes(Event event) const {
+    const size_t e = static_cast<size_t>(event);
+    return e < EventCount ? _routes[e] : 0;
+  }
+
+  private:
+  struct Region {
+    void* machine;
+    TranResult (*dispatch)(void* machine, Event event);
+  };
+
+  template <typename Machine>
+  static TranResult dispatchTo(void* machine, Event event) {
+    return static_cast<Machine*>(machine)->dispatch(event);
+  }
+
+  template <typename Machine>
+  void route(const Machine& machine, size_t region) {
+    for (size_t event = 0; event < EventCount; event++) {
+      if (machine.getDefinition().handles(static_cast<Event>(event)))
+        _routes[event] |= uint32_t(1) << region;
+    }
+  }
+
+  ResultMask process(Event event) {
+    const uint32_t routes = getRoutes(event);
+    if (routes == 0) return TranResult::NotFound;
+
+    ResultMask results;
+    for (size_t region = 0; region < kRegionCount; region++) {
+      if (routes & (uint32_t(1) << region))
+        results = results | _regions[region].dispatch(_regions[region].machine, event);
+    }
+
+    return results;
+  }
+
+  Region _regions[kRegionCount];
+  uint32_t _routes[EventCount];
+  detail::RunToCompletion<Event, STATEFORGE_RTC_QUEUE_SIZE> _rtc;
+};
+
+/**
+ * Drains the event queues of a set of machines from Workers tasks, without any lock in dispatch().
+ * Each queue is added with a home worker, which drains it first; an idle worker steals the whole
+ * queue of a machine whose home worker is busy. A queue is claimed by one worker at a time, so the
+ * hooks of a machine never run concurrently, and at most batch events are drained per claim so one
+ * busy machine does not starve the others. A queue is any type with processPending(max), such as
+ * EventQueue. Add every queue before start(); on the host, call runOnce().
+ */
+template <size_t MaxQueues, size_t Workers = 2>
+class Executor {
+  static_assert((MaxQueues > 0) && (Workers > 0), "Executor needs at least one queue and worker!");
+
+  public:
+  explicit Executor(size_t batch = 8)
+      : _count(0)
+      , _batch(batch)
+      , _stopping(false) {
+    for (auto& entry : _entries)
+      entry.claimed.store(false, std::memory_order_relaxed);
+  }
+
+#if defined(ESP_PLATFORM)
+  ~Executor() {
+    stop();
+    if (_exited) vSemaphoreDelete(_exited);
+  }
+#endif
+
+  Executor(const Executor&)            = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  // Returns false when the executor is full or home is not a worker
+  template <typename Queue>
+  bool add(Queue& queue, size_t home = 0) {
+    if ((_count == MaxQueues) || (home >= Workers)) return false;
+
+    Entry& entry = _entries[_count++];
+    entry.queue  = &queue;
+    entry.drain  = &drainQueue<Queue>;
+    entry.home   = home;
+    entry.stolen = 0;
+    return true;
+  }
+
+  /**
+   * One round of worker: a batch from each of its own queues, or when none had events, a batch
+   * from the first pending queue of another worker. Returns how many events were processed.
+   */
+  size_t runOnce(size_t worker) {
+    size_t processed = 0;
+    for (size_t i = 0; i < _count; i++) {
+      if (_entries[i].home == worker) processed += drain(_entries[i], worker);
+    }
+
+    if (processed > 0) return processed;
+
+    for (size_t i = 0; i < _count; i++) {
+      Entry& entry = _entries[(worker + 1 + i) % _count];
+      if (entry.home == worker) continue;
+
+      processed = drain(entry, worker);
+      if (processed > 0) return processed;
+    }
+
+    return 0;
+  }
+
+  size_t size() const { return _count; }
+  size_t getHome(size_t queue) const { return _entries[queue].home; }
+
+  // Times a queue was drained by another worker than its home
+  size_t getStolen(size_t queue) const { return _entries[queue].stolen; }
+
+#if defined(ESP_PLATFORM)
+  /**
+   * Spawns one task per worker, pinning worker w to core w % portNUM_PROCESSORS. Idle workers
+   * block until notify() or idle_ticks pass, so events posted without a notify() are still picked
+   * up. Returns false when already started, or if a task could not be created, in which case the
+   * workers started so far are stopped again.
+   */
+  bool start(uint32_t stack_size = 4096, UBaseType_t priority = 5,
+    TickType_t idle_ticks = pdMS_TO_TICKS(10)) {
+    if (_running > 0) return false;
+    if (!_exited) _exited = xSemaphoreCreateCountingStatic(Workers, 0, &_exited_buffer);
+
+    _stopping.store(false, std::memory_order_relaxed);
+    _idle_ticks = idle_ticks;
+
+    for (size_t w = 0; w < Workers; w++) {
+      _workers[w].executor = this;
+      _workers[w].index    = w;
+
+      TaskHandle_t task = nullptr;
+      if (xTaskCreatePinnedToCore(workerTask,
+            "stateforge",
+            stack_size,
+            &_workers[w],
+            priority,
+            &task,
+            static_cast<BaseType_t>(w % portNUM_PROCESSORS)) != pdPASS) {
+        stop();
+        return false;
+      }
+
+      portENTER_CRITICAL(&_lock);
+      _workers[w].task = task;
+      portEXIT_CRITICAL(&_lock);
+      _running++;
+    }
+
+    return true;
+  }
+
+  /**
+   * Asks the workers to exit after their current round and blocks until all of them have, so the
+   * executor can then be destroyed or started again. Not from a worker, which would wait on itself.
+   */
+  void stop() {
+    _stopping.store(true, std::memory_order_relaxed);
+    notify();
+
+    for (; _running > 0; _running--)
+      xSemaphoreTake(_exited, portMAX_DELAY);
+  }
+
+  // Wakes the idle workers, from a task or an ISR, e.g. right after posting to a queue
+  void notify() {
+    const bool isr   = xPortInIsrContext();
+    BaseType_t woken = pdFALSE;
+
+    // Under the lock, so an exiting worker cannot hand its handle back and be deleted meanwhile
+    portENTER_CRITICAL_SAFE(&_lock);
+    for (auto& worker : _workers) {
+      if (worker.task == nullptr) continue;
+
+      if (isr)
+        vTaskNotifyGiveFromISR(worker.task, &woken);
+      else
+        xTaskNotifyGive(worker.task);
+    }
+    portEXIT_CRITICAL_SAFE(&_lock);
+
+    if (woken) portYIELD_FROM_ISR();
+  }
+#endif
+
+  private:
+  struct Entry {
+    void* queue;
+    size_t (*drain)(void* queue, size_t max);
+    size_t home;
+    size_t stolen;
+    std::atomic<bool> claimed;
+  };
+
+  template <typename Queue>
+  static size_t drainQueue(void* queue, size_t max) {
+    return static_cast<Queue*>(queue)->processPending(max);
+  }
+
+  // The claim hands the queue over with acquire/release, so its consumer side needs no lock
+  size_t drain(Entry& entry, size_t worker) {
+    bool expected = false;
+    if (!entry.claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+      return 0;
+
+    const size_t processed = entry.drain(entry.queue, _batch);
+    if ((processed > 0) && (entry.home != worker)) entry.stolen++;
+
+    entry.claimed.store(false, std::memory_order_release);
+    return processed;
+  }
+
+#if defined(ESP_PLATFORM)
+  struct Worker {
+    Executor* executor;
+    size_t index;
+    TaskHandle_t task;
+  };
+
+  static void workerTask(void* argument) {
+    Worker& worker     = *static_cast<Worker*>(argument);
+    Executor& executor = *worker.executor;
+
+    while (!executor._stopping.load(std::memory_order_relaxed)) {
+      if (executor.runOnce(worker.index) == 0) ulTaskNotifyTake(pdTRUE, executor._idle_ticks);
+    }
+
+    portENTER_CRITICAL(&executor._lock);
+    worker.task = nullptr;
+    portEXIT_CRITICAL(&executor._lock);
+
+    // The executor may be gone as soon as stop() sees this, so it is the last access to it
+    xSemaphoreGive(executor._exited);
+    vTaskDelete(nullptr);
+  }
+
+  Worker _workers[Workers]  = {};
+  TickType_t _idle_ticks    = 0;
+  size_t _running           = 0;
+  portMUX_TYPE _lock        = portMUX_INITIALIZER_UNLOCKED;
+  SemaphoreHandle_t _exited = nullptr;
+  StaticSemaphore_t _exited_buffer;
+#endif
+
+  Entry _entries[MaxQueues];
+  size_t _count;
+  size_t _batch;
+  std::atomic<bool> _stopping;
+};
+
+/**
+ * Transition entry for StaticStateMachine. Hooks are plain function pointers so a table of these
+ * can be declared constexpr and placed in flash.
+ */
+template <typename StateType, typename EventType>
+struct StaticTransition {
+  using EnterHook = void (*)(StateType from, EventType event, StateType to, Context* const context);
+  using TransitionHook =
+    TranResult (*)(StateType from, EventType event, StateType to, Context* const context);
+  using ExitHook = EnterHook;
+  using Guard    = bool (*)(StateType from, EventType event, StateType to,
+    Context* const context) STATEFORGE_GUARD_NOEXCEPT;
+
+  // guard is defaulted, as in Transition
+  constexpr StaticTransition(StateType from, EventType event, StateType to, EnterHook on_enter,
+    TransitionHook on_transition, ExitHook on_exit, Context* const context, Guard guard = nullptr)
+      : from(from)
+      , event(event)
+      , to(to)
+      , on_enter(on_enter)
+      , on_transition(on_transition)
+      , on_exit(on_exit)
+      , context(context)
+      , guard(guard) {}
+
+  StateType from;
+  EventType event;
+  StateType to;
+
+  EnterHook on_enter;
+  TransitionHook on_transition;
+  ExitHook on_exit;
+
+  Context* const context;
+  Guard guard;
+};
+
+namespace detail {
+// Compile-time helpers over constexpr transition tables. They split ranges in halves so the
+// recursion depth stays logarithmic in the table size (C++11 constexpr has no loops).
+// Through a function, so hooks known at compile time do not warn as never null
+template <typename Function>
+constexpr bool isSet(Function function) {
+  return function != nullptr;
+}
+
+template <typename Entry, size_t Size>
+constexpr bool keyMatchesAny(const Entry (&table)[Size], size_t entry, size_t lo, size_t hi) {
+  return (hi <= lo)        ? false
+         : (hi - lo == 1) ? sameKey(table[entry], table[lo])
+                          : keyMatchesAny(table, entry, lo, lo + (hi - lo) / 2) ||
+                              keyMatchesAny(table, entry, lo + (hi - lo) / 2, hi);
+}
+
+// A guarded entry may share its key with later ones, an unguarded one makes them unreachable
+template <typename Entry, size_t Size>
+constexpr bool hasDuplicateKey(const Entry (&table)[Size], size_t lo, size_t hi) {
+  return (hi <= lo)        ? false
+         : (hi - lo == 1) ? (table[lo].guard == nullptr) && keyMatchesAny(table, lo, lo + 1, Size)
+                          : hasDuplicateKey(table, lo, lo + (hi - lo) / 2) ||
+                              hasDuplicateKey(table, lo + (hi - lo) / 2, hi);
+}
+
+template <typename Entry, size_t Size, typename StateType>
+constexpr size_t findEnterIn(const Entry (&table)[Size], StateType state, size_t lo, size_t hi) {
+  return (hi <= lo) ? kNoTransition
+         : (hi - lo == 1)
+           ? (((table[lo].from == state) && (table[lo].on_enter != nullptr)) ? lo : kNoTransition)
+           : firstOf(findEnterIn(table, state, lo, lo + (hi - lo) / 2),
+               findEnterIn(table, state, lo + (hi - lo) / 2, hi));
+}
+
+// The checks of checkTable(), over a flat table and in the same order
+
+template <typename Entry, size_t Size>
+constexpr size_t firstOutOfRange(const Entry (&table)[Size], size_t lo, size_t hi) {
+  return (hi <= lo) ? kNoTransition
+         : (hi - lo == 1)
+           ? (((!isAny(table[lo].from) && (bitOf(table[lo].from) == 0)) ||
+                (bitOf(table[lo].to) == 0))
+                 ? lo
+                 : kNoTransition)
+           : firstOf(firstOutOfRange(table, lo, lo + (hi - lo) / 2),
+               firstOutOfRange(table, lo + (hi - lo) / 2, hi));
+}
+
+template <typename Entry, size_t Size>
+constexpr bool unguardedKeyIn(const Entry (&table)[Size], size_t entry, size_t lo, size_t hi) {
+  return (hi <= lo)        ? false
+         : (hi - lo == 1) ? !isSet(table[lo].guard) && sameKey(table[entry], table[lo])
+                          : unguardedKeyIn(table, entry, lo, lo + (hi - lo) / 2) ||
+                              unguardedKeyIn(table, entry, lo + (hi - lo) / 2, hi);
+}
+
+template <typename Entry, size_t Size>
+constexpr size_t firstDuplicate(const Entry (&table)[Size], size_t lo, size_t hi) {
+  return (hi <= lo)        ? kNoTransition
+         : (hi - lo == 1) ? (unguardedKeyIn(table, lo, 0, lo) ? lo : kNoTransition)
+                          : firstOf(firstDuplicate(table, lo, lo + (hi - lo) / 2),
+                              firstDuplicate(table, lo + (hi - lo) / 2, hi));
+}
+
+// States of [lo, hi) with an unguarded entry that takes precedence over the wildcard entry
+template <typename Entry, size_t Size>
+constexpr uint64_t coveredStates(const Entry (&table)[Size], size_t wildcard, size_t lo,
+  size_t hi) {
+  return (hi <= lo) ? 0
+         : (hi - lo == 1)
+           ? ((!isAny(table[lo].from) && !isSet(table[lo].guard) &&
+                (isAny(table[lo].event) || (table[lo].event == table[wildcard].event)))
+                 ? bitOf(table[lo].from)
+                 : 0)
+           : coveredStates(table, wildcard, lo, lo + (hi - lo) / 2) |
+               coveredStates(table, wildcard, lo + (hi - lo) / 2, hi);
+}
+
+template <typename Entry, size_t Size>
+constexpr bool firesFrom(const Entry (&table)[Size], size_t entry, uint64_t mask) {
+  return isAny(table[entry].from) ? (mask & ~coveredStates(table, entry, 0, Size)) != 0
+                                  : (mask & bitOf(table[entry].from)) != 0;
+}
+
+// Targets of the entries of [lo, hi) that fire from a state of mask
+template <typename Entry, size_t Size>
+constexpr uint64_t targetsFrom(const Entry (&table)[Size], uint64_t mask, size_t lo, size_t hi) {
+  return (hi <= lo)        ? 0
+         : (hi - lo == 1) ? (firesFrom(table, lo, mask) ? bitOf(table[lo].to) : 0)
+                          : targetsFrom(table, mask, lo, lo + (hi - lo) / 2) |
+                              targetsFrom(table, mask, lo + (hi - lo) / 2, hi);
+}
+
+// Grows mask by every state one transition away until it settles, at most 64 rounds
+template <typename Entry, size_t Size>
+constexpr uint64_t reachableFrom(const Entry (&table)[Size], uint64_t mask) {
+  return (targetsFrom(table, mask, 0, Size) & ~mask) == 0
+           ? mask
+           : reachableFrom(table, mask | targetsFrom(table, mask, 0, Size));
+}
+
+template <typename Entry, size_t Size>
+constexpr size_t firstFromOutside(const Entry (&table)[Size], uint64_t mask, size_t lo,
+  size_t hi) {
+  return (hi <= lo) ? kNoTransition
+         : (hi - lo == 1)
+           ? ((!isAny(table[lo].from) && !(mask & bitOf(table[lo].from))) ? lo : kNoTransition)
+           : firstOf(firstFromOutside(table, mask, lo, lo + (hi - lo) / 2),
+               firstFromOutside(table, mask, lo + (hi - lo) / 2, hi));
+}
+
+template <typename Entry, size_t Size>
+constexpr size_t firstShadowed(const Entry (&table)[Size], uint64_t reached, size_t lo,
+  size_t hi) {
+  return (hi <= lo) ? kNoTransition
+         : (hi - lo == 1)
+           ? ((isAny(table[lo].from) && !firesFrom(table, lo, reached)) ? lo : kNoTransition)
+           : firstOf(firstShadowed(table, reached, lo, lo + (hi - lo) / 2),
+               firstShadowed(table, reached, lo + (hi - lo) / 2, hi));
+}
+
+constexpr TableCheck issueAt(TableIssue issue, size_t entry, TableCheck next) {
+  return entry != kNoTransition ? TableCheck{issue, entry} : next;
+}
+
+template <typename Entry, size_t Size>
+constexpr TableCheck checkReached(const Entry (&table)[Size], uint64_t reached) {
+  return issueAt(TableIssue::DeadState,
+    firstFromOutside(table, reached, 0, Size),
+    issueAt(TableIssue::Shadowed,
+      firstShadowed(table, reached, 0, Size),
+      TableCheck{TableIssue::None, kNoTransition}));
+}
+
+template <typename Entry, size_t Size, typename StateType>
+constexpr TableCheck checkStaticTable(const Entry (&table)[Size], StateType initial) {
+  return bitOf(initial) == 0
+           ? TableCheck{TableIssue::OutOfRange, kNoTransition}
+           : issueAt(TableIssue::OutOfRange,
+               firstOutOfRange(table, 0, Size),
+               issueAt(TableIssue::Duplicate,
+                 firstDuplicate(table, 0, Size),
+                 checkReached(table, reachableFrom(table, bitOf(initial)))));
+}
+} // namespace detail
+
+/**
+ * State machine over a constexpr table of StaticTransition. The table is a template argument, so
+ * it stays in flash/rodata, dispatch is expanded at compile time into a tree of constant
+ * comparisons with direct hook calls, and (from, event) pairs declared again after an unguarded
+ * entry fail to compile.
+ *
+ * Usage:
+ *   constexpr StaticTransition<States, Events> table[] = {...};
+ *   StaticStateMachine<States, Events, 3, table> sm(States::Initial);
+ */
+template <typename StateType, typename EventType, size_t Size,
+  const StaticTransition<StateType, EventType> (&Table)[Size]>
+class StaticStateMachine {
+  static_assert(std::is_enum<StateType>::value, "StateType must be an enum class!");
+  static_assert(std::is_enum<EventType>::value, "EventType must be an enum class!");
+  static_assert(!detail::hasDuplicateKey(Table, 0, Size),
+    "Transition table contains a (from, event) pair declared again after an unguarded entry!");
+
+  public:
+  using State = StateType;
+  using Event = EventType;
+
+  constexpr StaticStateMachine(StateType initial_state)
+      : _initial_state(initial_state)
+      , _current_state(initial_state)
+      , _rtc() {}
+
+  ~StaticStateMachine()                                    = default;
+  StaticStateMachine(const StaticStateMachine&)            = delete;
+  StaticStateMachine& operator=(const StaticStateMachine&) = delete;
+  StaticStateMachine(StaticStateMachine&&)                 = delete;
+  StaticStateMachine& operator=(StaticStateMachine&&)      = delete;
+
+  // Same run-to-completion rules as StateMachine::dispatch()
+  TranResult dispatch(EventType event) {
+    if (_rtc.isBusy()) return _rtc.push(event) ? TranResult::Deferred : TranResult::Overflow;
+
+    _rtc.setBusy(true);
+    const TranResult result = process(event);
+
+    EventType deferred;
+    while (_rtc.pop(deferred))
+      process(deferred);
+
+    _rtc.setBusy(false);
+    return result;
+  }
+
+  StateType getCurrentState() const { return _current_state; }
+  void resetState() { _current_state = _initial_state; }
+
+  /**
+   * Same checks as MachineDefinition::validate(), at compile time, e.g.
+   *   static_assert(Machine::validate(States::Initial).issue == TableIssue::None, "...");
+   */
+  static constexpr TableCheck validate(StateType initial_state) {
+    return detail::checkStaticTable(Table, initial_state);
+  }
+
+  Context* getContext(StateType from, EventType event, StateType to) const {
+    for (const auto& transition : Table) {
+      if ((transition.from == from) && (transition.event == event) && (transition.to == to)) {
+        return transition.context;
+      }
+    }
+
+    return nullptr;
+  }
+
+  private:
+  using Entry   = StaticTransition<StateType, EventType>;
+  using NoEnter = std::integral_constant<size_t, detail::kNoTransition>;
+
+  // One pass per wildcard kind, in priority order; entries of other kinds fold away
+  TranResult process(EventType event) {
+    TranResult result     = TranResult::NotFound;
+    const StateType state = _current_state;
+
+    search<false, false>(state, event, result) || search<false, true>(state, event, result) ||
+      search<true, false>(state, event, result) || search<true, true>(state, event, result);
+
+    return result;
+  }
+
+  // Also ends the search when the pass only found candidates rejected by their guards
+  template <bool AnyFrom, bool AnyEvent>
+  bool search(StateType state, EventType event, TranResult& result) {
+    return Select<0, Size, AnyFrom, AnyEvent>::run(*this, state, event, result) ||
+           (result == TranResult::NoChange);
+  }
+
+  // Binary split of [Lo, Hi) down to single entries, each compared against constants
+  template <size_t Lo, size_t Hi, bool AnyFrom, bool AnyEvent, bool Leaf = (Hi - Lo == 1)>
+  struct Select {
+    static bool run(StaticStateMachine& sm, StateType state, EventType event, TranResult& result) {
+      return Select<Lo, Lo + (Hi - Lo) / 2, AnyFrom, AnyEvent>::run(sm, state, event, result) ||
+             Select<Lo + (Hi - Lo) / 2, Hi, AnyFrom, AnyEvent>::run(sm, state, event, result);
+    }
+  };
+
+  template <size_t Lo, size_t Hi, bool AnyFrom, bool AnyEvent>
+  struct Select<Lo, Hi, AnyFrom, AnyEvent, true> {
+    static bool run(StaticStateMachine& sm, StateType state, EventType event, TranResult& result) {
+      if ((detail::isAny(Table[Lo].from) != AnyFrom) ||
+          (detail::isAny(Table[Lo].event) != AnyEvent))
+        return false;
+      if (!AnyFrom && (Table[Lo].from != state)) return false;
+      if (!AnyEvent && (Table[Lo].event != event)) return false;
+
+      // A rejected candidate lets the search go on to the next one with the same key
+      const Entry& candidate = Table[Lo];
+      if (detail::isSet(candidate.guard) &&
+          !candidate.guard(state, event, candidate.to, candidate.context)) {
+        result = TranResult::NoChange;
+        return false;
+      }
+
+      result = sm.template fire<Lo>(state, event);
+      return true;
+    }
+  };
+
+  template <size_t Index>
+  TranResult fire(StateType state, EventType event) {
+    const Entry& transition = Table[Index];
+    TranResult result       = TranResult::Change;
+
+    // Wildcard transitions report the actual state and event to their hooks
+    const StateType from    = detail::isAny(transition.from) ? state : transition.from;
+    const EventType trigger = detail::isAny(transition.event) ? event : transition.event;
+
+    if (detail::isSet(transition.on_transition))
+      result = transition.on_transition(from, trigger, transition.to, transition.context);
+
+    if (detail::isSet(transition.on_exit))
+      transition.on_exit(from, trigger, transition.to, transition.context);
+
+    // Same enter hook rules as StateMachine; the next state's hook is resolved at compile time
+    if (result == TranResult::Reset)
+      enterInitial(from, trigger, transition.to);
+    else
+      enter(from,
+        trigger,
+        transition.to,
+        std::integral_constant<size_t, detail::findEnterIn(Table, Table[Index].to, 0, Size)>());
+
+    switch (result) {
+      case TranResult::Change: _current_state = transition.to; return result;
+      case TranResult::Reset: _current_state = _initial_state; return result;
+      default: return result;
+    }
+  }
+
+  template <size_t Enter>
+  static void enter(StateType from, EventType event, StateType to,
+    std::integral_constant<size_t, Enter>) {
+    Table[Enter].on_enter(from, event, to, Table[Enter].context);
+  }
+
+  static void enter(StateType, EventType, StateType, NoEnter) {}
+
+  void enterInitial(StateType from, EventType event, StateType to) const {
+    for (const auto& next_transition : Table) {
+      if ((next_transition.from == _initial_state) && next_transition.on_enter) {
+        next_transition.on_enter(from, event, to, next_transition.context);
+        break;
+      }
+    }
+  }
+
+  StateType _initial_state;
+  StateType _current_state;
+  detail::RunToCompletion<EventType, STATEFORGE_RTC_QUEUE_SIZE> _rtc;
+};
+
+/**
+ * Row of a binary transition table before encoding (see BinaryDefinition::encode()): hooks are
+ * given by their ID in a BinaryHooks registry, or BinaryDefinition::kNoHook.
+ */
+template <typename StateType, typename EventType>
+struct BinaryEntry {
+  StateType from;
+  EventType event;
+  StateType to;
+
+  uint8_t on_enter;
+  uint8_t on_transition;
+  uint8_t on_exit;
+  uint8_t guard;
+  uint8_t context;
+  uint32_t after;
+};
+
+/**
+ * Functions and contexts the hook IDs of a binary table resolve into, one array per kind. IDs past
+ * the end of their array, or without an array, resolve to no hook. The registry itself is copied,
+ * but the arrays it points to are not and must outlive the machine.
+ */
+template <typename StateType, typename EventType>
+struct BinaryHooks {
+  using Hooks = StaticTransition<StateType, EventType>;
+
+  const typename Hooks::EnterHook* enter;
+  size_t enter_count;
+  const typename Hooks::TransitionHook* transition;
+  size_t transition_count;
+  const typename Hooks::ExitHook* exit;
+  size_t exit_count;
+  const typename Hooks::Guard* guards;
+  size_t guard_count;
+  Context* const* contexts;
+  size_t context_count;
+};
+
+// Transition of a binary table, decoded with its hooks resolved
+template <typename StateType, typename EventType>
+struct BinaryTransition {
+  using Hooks = StaticTransition<StateType, EventType>;
+
+  StateType from;
+  EventType event;
+  StateType to;
+
+  typename Hooks::EnterHook on_enter;
+  typename Hooks::TransitionHook on_transition;
+  typename Hooks::ExitHook on_exit;
+
+  Context* context;
+  typename Hooks::Guard guard;
+  uint32_t after;
+};
+
+namespace detail {
+// Wildcard value and missing hook ID of binary tables
+constexpr uint16_t kBinaryAny   = 0xFFFF;
+constexpr uint8_t kBinaryNoHook = 0xFF;
+
+template <typename Hook>
+Hook hookAt(const Hook* hooks, size_t count, uint8_t id) {
+  return (hooks && (id < count)) ? hooks[id] : nullptr;
+}
+
+// Table interface (size() and operator[]) over the entries of a binary image, decoded on access
+template <typename StateType, typename EventType>
+class BinaryTable {
+  public:
+  using Entry = BinaryTransition<StateType, EventType>;
+
+  BinaryTable(const uint8_t* entries, size_t count, size_t entry_size,
+    const BinaryHooks<StateType, EventType>& hooks)
+      : _entries(entries)
+      , _count(count)
+      , _entry_size(entry_size)
+      , _hooks(hooks) {}
+
+  size_t size() const { return _count; }
+
+  // Keys of entry index alone, without resolving its hooks (see fromOf())
+  StateType fromAt(size_t index) const {
+    return toEnum<StateType>(readLittle<uint16_t>(at(index)));
+  }
+
+  EventType eventAt(size_t index) const {
+    return toEnum<EventType>(readLittle<uint16_t>(at(index) + 2));
+  }
+
+  Entry operator[](size_t index) const {
+    const uint8_t* in = at(index);
+    return {toEnum<StateType>(readLittle<uint16_t>(in)),
+      toEnum<EventType>(readLittle<uint16_t>(in + 2)),
+      toEnum<StateType>(readLittle<uint16_t>(in + 4)),
+      hookAt(_hooks.enter, _hooks.enter_count, in[6]),
+      hookAt(_hooks.transition, _hooks.transition_count, in[7]),
+      hookAt(_hooks.exit, _hooks.exit_count, in[8]),
+      hookAt(_hooks.contexts, _hooks.context_count, in[10]),
+      hookAt(_hooks.guards, _hooks.guard_count, in[9]),
+      readLittle<uint32_t>(in + 12)};
+  }
+
+  // Whether every hook ID of entry index names a registered hook
+  bool isResolved(size_t index) const {
+    const uint8_t* in = at(index);
+    return known(in[6], _hooks.enter_count) && known(in[7], _hooks.transition_count) &&
+           known(in[8], _hooks.exit_count) && known(in[9], _hooks.guard_count) &&
+           known(in[10], _hooks.context_count);
+  }
+
+  private:
+  template <typename Enum>
+  static Enum toEnum(uint16_t value) {
+    return value == kBinaryAny ? any<Enum>() : static_cast<Enum>(value);
+  }
+
+  static bool known(uint8_t id, size_t count) { return (id == kBinaryNoHook) || (id < count); }
+
+  const uint8_t* at(size_t index) const { return _entries + index * _entry_size; }
+
+  const uint8_t* _entries;
+  size_t _count;
+  size_t _entry_size;
+  BinaryHooks<StateType, EventType> _hooks;
+};
+} // namespace detail
+
+/**
+ * Definition over a transition table in a versioned binary image, such as a flash partition mapped
+ * with PartitionImage, so machine logic can be updated over the air without reflashing. The image
+ * is used in place: construction only checks its header, so it takes the same time and no RAM
+ * whatever the table size, and dispatch scans it like LinearIndex, with the same priorities and
+ * guard fallback as MachineDefinition. Scans read the keys of the entries they skip and only
+ * resolve the hooks of the ones that match. Use BinaryStateMachine.
+ *
+ * The image is little-endian, without alignment requirements:
+ *   "SFM" | version (1) | state count (u16) | transition count (u16) | initial state (u16) |
+ *   entry size (u16) | entries
+ * and each entry, 16 bytes in version 1 (larger entries are read and their tail skipped):
+ *   from (u16) | event (u16) | to (u16) | on_enter | on_transition | on_exit | guard | context |
+ *   reserved | after (u32)
+ * Wildcards are 0xFFFF, and hooks are u8 IDs into a BinaryHooks registry, 0xFF for none. encode()
+ * writes an image. An image that does not load leaves the definition empty: every dispatch
+ * returns NotFound and validate() reports OutOfRange without an entry.
+ */
+template <typename StateType, typename EventType>
+class BinaryDefinition {
+  static_assert(std::is_enum<StateType>::value, "StateType must be an enum class!");
+  static_assert(std::is_enum<EventType>::value, "EventType must be an enum class!");
+
+  public:
+  using State           = StateType;
+  using Event           = EventType;
+  using ContextPointer  = Context*;
+  using TransitionType  = BinaryTransition<StateType, EventType>;
+  using TransitionTable = detail::BinaryTable<StateType, EventType>;
+  using EntryType       = BinaryEntry<StateType, EventType>;
+  using HooksType       = BinaryHooks<StateType, EventType>;
+
+  static constexpr uint8_t kVersion   = 1;
+  static constexpr size_t kHeaderSize = 12;
+  static constexpr size_t kEntrySize  = 16;
+  static constexpr uint8_t kNoHook    = detail::kBinaryNoHook;
+
+  BinaryDefinition(StateType initial_state, const uint8_t* image, size_t size,
+    const HooksType& hooks)
+      : _initial_state(initial_state)
+      , _state_count(field(image, size, 4, 0))
+      , _transitions(isImage(image, size) ? image + kHeaderSize : nullptr,
+          field(image, size, 6, 0), field(image, size, 10, kEntrySize), hooks) {}
+
+  ~BinaryDefinition()                                  = default;
+  BinaryDefinition(const BinaryDefinition&)            = delete;
+  BinaryDefinition& operator=(const BinaryDefinition&) = delete;
+  BinaryDefinition(BinaryDefinition&&)                 = delete;
+  BinaryDefinition& operator=(BinaryDefinition&&)      = delete;
+
+  // Whether image holds a complete table of a version this definition reads
+  static bool isImage(const uint8_t* image, size_t size) {
+    if (!image || (size < kHeaderSize)) return false;
+    if ((image[0] != 'S') || (image[1] != 'F') || (image[2] != 'M') || (image[3] != kVersion))
+      return false;
+
+    const size_t count      = detail::readLittle<uint16_t>(image + 6);
+    const size_t entry_size = detail::readLittle<uint16_t>(image + 10);
+    return (entry_size >= kEntrySize) && (size >= kHeaderSize + count * entry_size);
+  }
+
+  // Initial state stored in image, the first state when it is not an image
+  static StateType initialOf(const uint8_t* image, size_t size) {
+    return static_cast<StateType>(field(image, size, 8, 0));
+  }
+
+  // Bytes encode() writes for count entries
+  static constexpr size_t imageSize(size_t count) { return kHeaderSize + count * kEntrySize; }
+
+  /**
+   * Writes the image of entries to buffer and returns its size, or 0 when buffer is smaller than
+   * imageSize(count) or there are more than 65535 entries. Meant for host tools that build the
+   * partition contents.
+   */
+  static size_t encode(StateType initial, size_t state_count, const EntryType* entries,
+    size_t count, uint8_t* buffer, size_t buffer_size) {
+    if ((count > UINT16_MAX) || (buffer_size < imageSize(count))) return 0;
+
+    uint8_t* out = buffer;
+    *out++       = 'S';
+    *out++       = 'F';
+    *out++       = 'M';
+    *out++       = kVersion;
+    out          = put(out, static_cast<uint16_t>(state_count));
+    out          = put(out, static_cast<uint16_t>(count));
+    out          = put(out, static_cast<uint16_t>(initial));
+    out          = put(out, static_cast<uint16_t>(kEntrySize));
+
+    for (size_t i = 0; i < count; i++) {
+      const EntryType& entry = entries[i];
+      out                    = put(out, valueOf(entry.from));
+      out                    = put(out, valueOf(entry.event));
+      out                    = put(out, valueOf(entry.to));
+      *out++                 = entry.on_enter;
+      *out++                 = entry.on_transition;
+      *out++                 = entry.on_exit;
+      *out++                 = entry.guard;
+      *out++                 = entry.context;
+      *out++                 = 0;
+      out                    = put(out, entry.after);
+    }
+
+    return static_cast<size_t>(out - buffer);
+  }
+
+  bool isLoaded() const { return _state_count > 0; }
+
+  StateType getInitialState() const { return _initial_state; }
+
+  // Decoding view of the table, e.g. for a GraphExporter
+  const TransitionTable& getTransitions() const { return _transitions; }
+
+  // Runs the transition for event from state, and stores the next state in state on commit
+  template <typename Monitor>
+  TranResult step(StateType& state, EventType event, Monitor& monitor) const {
+    const size_t found = _index.find(_transitions, state, event);
+    if (found == detail::kNoTransition) {
+      monitor.onNotFound(static_cast<size_t>(state), static_cast<size_t>(event));
+      return TranResult::NotFound;
+    }
+
+    const size_t match = detail::firstEnabled(_transitions, found, state, event);
+    if (match == detail::kNoTransition) return TranResult::NoChange;
+
+    monitor.onTransition(match);
+    const TransitionType transition = _transitions[match];
+
+    // Wildcard transitions report the actual state and event to their hooks
+    const StateType from    = detail::isAny(transition.from) ? state : transition.from;
+    const EventType trigger = detail::isAny(transition.event) ? event : transition.event;
+    TranResult result       = TranResult::Change;
+
+    if (transition.on_transition) {
+      const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Transition);
+      result = transition.on_transition(from, trigger, transition.to, transition.context);
+    }
+
+    if (transition.on_exit) {
+      const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Exit);
+      transition.on_exit(from, trigger, transition.to, transition.context);
+    }
+
+    // Reset enters the initial state instead of the target
+    enter(result == TranResult::Reset ? _initial_state : transition.to, from, trigger,
+      transition.to, monitor, match);
+
+    switch (result) {
+      case TranResult::Change: state = transition.to; return result;
+      case TranResult::Reset: state = _initial_state; return result;
+      default: return result;
+    }
+  }
+
+  // Index of the timed transition of state, detail::kNoTransition when it has none
+  size_t findTimed(StateType state) const { return _index.findTimed(_transitions, state); }
+
+  // Delay and event of the timed transition of state, or 0 when it has none
+  uint32_t getTimeout(StateType state, EventType& event) const {
+    const size_t timed = _index.findTimed(_transitions, state);
+    if (timed == detail::kNoTransition) return 0;
+
+    const TransitionType transition = _transitions[timed];
+    event                           = transition.event;
+    return transition.after;
+  }
+
+  // First problem of the table (see TableIssue), hook IDs with nothing registered included
+  TableCheck validate() const {
+    if (!isLoaded()) return {TableIssue::OutOfRange, detail::kNoTransition};
+
+    for (size_t i = 0; i < _transitions.size(); i++) {
+      if (!_transitions.isResolved(i)) return {TableIssue::OutOfRange, i};
+    }
+
+    return detail::checkTable(_transitions, _initial_state, _state_count, detail::bitOf<StateType>);
+  }
+
+  bool hasState(StateType state) const { return static_cast<size_t>(state) < _state_count; }
+
+  // Runs the enter hook of state as if it was re-entered, with any<EventType>() as event
+  void enterState(StateType state) const {
+    NoMonitor monitor;
+    enter(state, state, any<EventType>(), state, monitor, detail::kNoTransition);
+  }
+
+  // Whether a transition matches event from state, guards not evaluated; does no side effect
+  bool accepts(StateType state, EventType event) const {
+    return _index.find(_transitions, state, event) != detail::kNoTransition;
+  }
+
+  // Whether some transition may fire for event, any event wildcards included; a linear scan
+  bool handles(EventType event) const {
+    for (size_t i = 0; i < _transitions.size(); i++) {
+      const EventType other = _transitions.eventAt(i);
+      if ((other == event) || detail::isAny(other)) return true;
+    }
+
+    return false;
+  }
+
+  Context* getContext(StateType from, EventType event, StateType to) const {
+    for (size_t i = 0; i < _transitions.size(); i++) {
+      if ((_transitions.fromAt(i) != from) || (_transitions.eventAt(i) != event)) continue;
+
+      const TransitionType transition = _transitions[i];
+      if (transition.to == to) return transition.context;
+    }
+
+    return nullptr;
+  }
+
+  private:
+  template <typename Monitor>
+  void enter(StateType state, StateType from, EventType event, StateType to, Monitor& monitor,
+    size_t match) const {
+    const size_t found = _index.findEnter(_transitions, state);
+    if (found == detail::kNoTransition) return;
+
+    const detail::HookTimer<Monitor> timer(monitor, match, HookStage::Enter);
+    const TransitionType transition = _transitions[found];
+    transition.on_enter(from, event, to, transition.context);
+  }
+
+  // Header field at offset, or fallback when image is not an image
+  static size_t field(const uint8_t* image, size_t size, size_t offset, size_t fallback) {
+    return isImage(image, size) ? detail::readLittle<uint16_t>(image + offset) : fallback;
+  }
+
+  template <typename Enum>
+  static uint16_t valueOf(Enum value) {
+    return detail::isAny(value) ? detail::kBinaryAny : static_cast<uint16_t>(value);
+  }
+
+  template <typename Integer>
+  static uint8_t* put(uint8_t* out, Integer value) {
+    for (size_t byte = 0; byte < sizeof(Integer); byte++)
+      *out++ = static_cast<uint8_t>(value >> (8 * byte));
+
+    return out;
+  }
+
+  StateType _initial_state;
+  size_t _state_count;
+  TransitionTable _transitions;
+  LinearIndex _index;
+};
+
+/**
+ * State machine over a binary table image (see BinaryDefinition), which starts in the initial
+ * state the image stores. The image and the hook arrays (see BinaryHooks) are not copied and must
+ * outlive the machine; check validate() once after loading a new image.
+ *
+ * Usage:
+ *   PartitionImage image;
+ *   image.map("machine");
+ *   BinaryStateMachine<States, Events> sm(image.getData(), image.getSize(), hooks);
+ */
+template <typename StateType, typename EventType, typename Monitor = NoMonitor>
+class BinaryStateMachine
+    : public BasicStateMachine<BinaryDefinition<StateType, EventType>, Monitor> {
+  using Base = BasicStateMachine<BinaryDefinition<StateType, EventType>, Monitor>;
+
+  public:
+  using Definition = BinaryDefinition<StateType, EventType>;
+
+  BinaryStateMachine(const uint8_t* image, size_t size, const typename Definition::HooksType& hooks)
+      : Base(Definition::initialOf(image, size), image, size, hooks) {}
+};
+
+#if defined(ESP_PLATFORM)
+/**
+ * Read-only mapping of a data partition into the address space, so a BinaryStateMachine runs from
+ * flash in place. The mapping is released on destruction and must outlive the machine.
+ */
+class PartitionImage {
+  public:
+  PartitionImage()
+      : _data(nullptr)
+      , _size(0)
+      , _handle() {}
+
+  ~PartitionImage() { unmap(); }
+  PartitionImage(const PartitionImage&)            = delete;
+  PartitionImage& operator=(const PartitionImage&) = delete;
+
+  // Maps the whole data partition named label; false when there is none or it can not be mapped
+  bool map(const char* label) {
+    unmap();
+
+    const esp_partition_t* partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!partition) return false;
+
+    const void* data = nullptr;
+    if (esp_partition_mmap(partition, 0, partition->size, kMapData, &data, &_handle) != ESP_OK)
+      return false;
+
+    _data = static_cast<const uint8_t*>(data);
+    _size = partition->size;
+    return true;
+  }
+
+  void unmap() {
+    if (!_data) return;
+
+  #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_partition_munmap(_handle);
+  #else
+    spi_flash_munmap(_handle);
+  #endif
+    _data = nullptr;
+    _size = 0;
+  }
+
+  const uint8_t* getData() const { return _data; }
+  size_t getSize() const { return _size; }
+
+  private:
+  #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  using Handle = esp_partition_mmap_handle_t;
+  static constexpr esp_partition_mmap_memory_t kMapData = ESP_PARTITION_MMAP_DATA;
+  #else
+  using Handle = spi_flash_mmap_handle_t;
+  static constexpr spi_flash_mmap_memory_t kMapData = SPI_FLASH_MMAP_DATA;
+  #endif
+
+  const uint8_t* _data;
+  size_t _size;
+  Handle _handle;
+};
+#endif
+
+// Text formats written by a GraphExporter
+enum class GraphFormat : uint8_t { Dot, PlantUml, Json };
+
+namespace detail {
+// Appends text to a buffer the way snprintf does: every character is counted, the ones that fit
+// are written and the buffer stays null terminated
+class TextWriter {
+  public:
+  TextWriter(char* buffer, size_t size)
+      : _buffer(buffer)
+      , _size(size)
+      , _length(0) {
+    if (_size > 0) _buffer[0] = '\0';
+  }
+
+  size_t length() const { return _length; }
+
+  void put(char c) {
+    if (_length + 1 < _size) {
+      _buffer[_length]     = c;
+      _buffer[_length + 1] = '\0';
+    }
+
+    _length++;
+  }
+
+  void put(const char* text) {
+    while (*text != '\0') put(*text++);
+  }
+
+  void putNumber(uint32_t value) {
+    char digits[10];
+    size_t count = 0;
+
+    do {
+      digits[count++] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value > 0);
+
+    while (count > 0) put(digits[--count]);
+  }
+
+  // Escapes quotes and backslashes, the same way in DOT and JSON strings
+  void putEscaped(const char* text) {
+    for (; *text != '\0'; text++) {
+      if ((*text == '"') || (*text == '\\')) put('\\');
+      put(*text);
+    }
+  }
+
+  void putQuoted(const char* text) {
+    put('"');
+    putEscaped(text);
+    put('"');
+  }
+
+  private:
+  char* _buffer;
+  size_t _size;
+  size_t _length;
+};
+
+// Timeout of a Transition, StaticTransition has none
+template <typename Entry>
+auto afterOf(const Entry& entry, int) -> decltype(static_cast<uint32_t>(entry.after)) {
+  return entry.after;
+}
+
+template <typename Entry>
+uint32_t afterOf(const Entry&, long) {
+  return 0;
+}
+
+template <typename Function>
+bool hasHook(const Function& function) {
+  return static_cast<bool>(function);
+}
+} // namespace detail
+
+/**
+ * Writes a transition table as a Graphviz DOT digraph, a PlantUML state diagram or JSON, with the
+ * guard, hooks and timeout of every transition, so diagrams can be generated from the table they
+ * describe instead of kept by hand (a host build step can run it over a constexpr table). States
+ * and events are named by the optional name functions, or by their value as S<n> and E<n>, and
+ * wildcards as "*".
+ *
+ * With hit counts set from a StatsMonitor, each transition also shows how often it ran, and DOT
+ * and PlantUML draw the ones with at least half of the highest count in bold.
+ *
+ * Usage:
+ *   GraphExporter<States, Events> exporter(GraphFormat::Dot, stateName, eventName);
+ *   exporter.setHits(sm.getMonitor().getStats().transitions);
+ *   char text[1024];
+ *   exporter.write(sm.getDefinition(), text, sizeof(text));
+ */
+template <typename StateType, typename EventType>
+class GraphExporter {
+  public:
+  using StateName = const char* (*)(StateType state);
+  using EventName = const char* (*)(EventType event);
+
+  explicit GraphExporter(GraphFormat format, StateName state_name = nullptr,
+    EventName event_name = nullptr)
+      : _format(format)
+      , _state_name(state_name)
+      , _event_name(event_name)
+      , _hits(nullptr)
+      , _hit_count(0) {}
+
+  // The counters are read on every write() and must outlive the exporter
+  template <size_t Count>
+  void setHits(const TransitionStats (&stats)[Count]) {
+    _hits      = stats;
+    _hit_count = Count;
+  }
+
+  void clearHits() {
+    _hits      = nullptr;
+    _hit_count = 0;
+  }
+
+  // Writes the graph of a MachineDefinition or HierarchicalDefinition to buffer like snprintf: the
+  // return value is the length of the whole text, and as much of it as fits is written, null
+  // terminated. A null buffer with a size of 0 only measures it.
+  template <typename Definition>
+  size_t write(const Definition& definition, char* buffer, size_t size) const {
+    return render(definition.getInitialState(), definition.getTransitions(),
+      definition.getTransitions().size(), buffer, size);
+  }
+
+  // Same, for a transition array such as the constexpr table of a StaticStateMachine
+  template <typename Entry, size_t Count>
+  size_t write(StateType initial, const Entry (&table)[Count], char* buffer, size_t size) const {
+    return render(initial, table, Count, buffer, size);
+  }
+
+  private:
+  template <typename Table>
+  size_t render(StateType initial, const Table& transitions, size_t count, char* buffer,
+    size_t size) const {
+    detail::TextWriter out(buffer, size);
+    uint32_t hottest = 0;
+
+    for (size_t i = 0; i < count; i++) {
+      if (hitsOf(i) > hottest) hottest = hitsOf(i);
+    }
+
+    begin(out, initial, transitions, count);
+    for (size_t i = 0; i < count; i++) {
+      const bool hot = (hottest > 0) && (hitsOf(i) >= hottest - hottest / 2);
+
+      if (_format == GraphFormat::Json) {
+        putJson(out, transitions[i], i);
+        out.put(i + 1 < count ? ",\n" : "\n");
+      } else {
+        putEdge(out, transitions[i], i, hot);
+      }
+    }
+
+    if (_format == GraphFormat::Dot) {
+      out.put("}\n");
+    } else {
+      out.put(_format == GraphFormat::PlantUml ? "@enduml\n" : "]}\n");
+    }
+
+    return out.length();
+  }
+
+  template <typename Table>
+  void begin(detail::TextWriter& out, StateType initial, const Table& transitions,
+    size_t count) const {
+    if (_format == GraphFormat::Json) {
+      out.put("{\"initial\":");
+      putState(out, initial);
+      out.put(",\"transitions\":[\n");
+      return;
+    }
+
+    bool any_state = false;
+    for (size_t i = 0; i < count; i++) any_state = any_state || detail::isAny(transitions[i].from);
+
+    if (_format == GraphFormat::Dot) {
+      out.put("digraph StateForge {\n  __initial [shape=point];\n");
+      if (any_state) out.put("  \"*\" [shape=plaintext];\n");
+      out.put("  __initial -> ");
+    } else {
+      out.put("@startuml\n");
+      if (any_state) out.put("state \"*\" as AnyState\n");
+      out.put("[*] --> ");
+    }
+
+    putState(out, initial);
+    out.put(_format == GraphFormat::Dot ? ";\n" : "\n");
+  }
+
+  // One line per transition: from -> to, labelled with the event, guard, hooks, timeout and hits
+  template <typename Entry>
+  void putEdge(detail::TextWriter& out, const Entry& transition, size_t index, bool hot) const {
+    const bool dot = _format == GraphFormat::Dot;
+
+    out.put(dot ? "  " : "");
+    putState(out, transition.from);
+    out.put(dot ? " -> " : hot ? " -[bold]-> " : " --> ");
+    putState(out, transition.to);
+    out.put(dot ? " [label=\"" : " : ");
+
+    putEvent(out, transition.event);
+    if (detail::hasHook(transition.guard)) out.put(" [guard]");
+
+    const char* separator = " / ";
+    if (detail::hasHook(transition.on_exit)) {
+      out.put(separator);
+      out.put("exit");
+      separator = ", ";
+    }
+
+    if (detail::hasHook(transition.on_transition)) {
+      out.put(separator);
+      out.put("transition");
+      separator = ", ";
+    }
+
+    if (detail::hasHook(transition.on_enter)) {
+      out.put(separator);
+      out.put("enter");
+    }
+
+    const uint32_t after = detail::afterOf(transition, 0);
+    if (after > 0) {
+      out.put(" after ");
+      out.putNumber(after);
+    }
+
+    if (index < _hit_count) {
+      out.put(" (hits: ");
+      out.putNumber(hitsOf(index));
+      out.put(')');
+    }
+
+    if (!dot) {
+      out.put('\n');
+      return;
+    }
+
+    out.put(hot ? "\", style=bold];\n" : "\"];\n");
+  }
+
+  template <typename Entry>
+  void putJson(detail::TextWriter& out, const Entry& transition, size_t index) const {
+    out.put("{\"from\":");
+    putState(out, transition.from);
+    out.put(",\"event\":");
+    putEvent(out, transition.event);
+    out.put(",\"to\":");
+    putState(out, transition.to);
+    out.put(",\"guard\":");
+    out.put(detail::hasHook(transition.guard) ? "true" : "false");
+    out.put(",\"on_enter\":");
+    out.put(detail::hasHook(transition.on_enter) ? "true" : "false");
+    out.put(",\"on_transition\":");
+    out.put(detail::hasHook(transition.on_transition) ? "true" : "false");
+    out.put(",\"on_exit\":");
+    out.put(detail::hasHook(transition.on_exit) ? "true" : "false");
+    out.put(",\"after\":");
+    out.putNumber(detail::afterOf(transition, 0));
+
+    if (index < _hit_count) {
+      out.put(",\"hits\":");
+      out.putNumber(hitsOf(index));
+    }
+
+    out.put('}');
+  }
+
+  // Quoted in DOT and JSON; PlantUML takes state names as they are, so they should be identifiers
+  void putState(detail::TextWriter& out, StateType state) const {
+    char fallback[12];
+    const char* name = detail::isAny(state) ? (_format == GraphFormat::PlantUml ? "AnyState" : "*")
+                                            : nameOf(_state_name, state, 'S', fallback);
+
+    if (_format == GraphFormat::PlantUml) {
+      out.put(name);
+    } else {
+      out.putQuoted(name);
+    }
+  }
+
+  // Quoted in JSON, and part of the edge label otherwise
+  void putEvent(detail::TextWriter& out, EventType event) const {
+    char fallback[12];
+    const char* name = detail::isAny(event) ? "*" : nameOf(_event_name, event, 'E', fallback);
+
+    if (_format == GraphFormat::Json) {
+      out.putQuoted(name);
+    } else if (_format == GraphFormat::Dot) {
+      out.putEscaped(name);
+    } else {
+      out.put(name);
+    }
+  }
+
+  template <typename Name, typename Enum>
+  static const char* nameOf(Name name, Enum value, char prefix, char (&fallback)[12]) {
+    const char* text = name ? name(value) : nullptr;
+    if (text) return text;
+
+    detail::TextWriter writer(fallback, sizeof(fallback));
+    writer.put(prefix);
+    writer.putNumber(static_cast<uint32_t>(value));
+    return fallback;
+  }
+
+  uint32_t hitsOf(size_t transition) const {
+    return transition < _hit_count ? _hits[transition].hits : 0;
+  }
+
+  GraphFormat _format;
+  StateName _state_name;
+  EventName _event_name;
+  const TransitionStats* _hits;
+  size_t _hit_count;
+};
+
+#if defined(__cpp_impl_coroutine)
+/**
+ * Coroutine returned by the on_transition hooks of an AsyncStateMachine: co_await any awaitable
+ * (e.g. an AsyncSignal set when an I2C read completes), then co_return the TranResult. It starts
+ * eagerly, so a hook that does not suspend completes within dispatch(). A plain TranResult also
+ * converts to a completed AsyncResult, for hooks that never wait.
+ */
+class AsyncResult {
+  public:
+  struct promise_type;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  // Keeps the frame alive at the end, so the result can be read, and tells a waiting owner
+  struct Final {
+    bool await_ready() noexcept { return false; }
+    void await_suspend(Handle handle) noexcept {
+      promise_type& promise = handle.promise();
+      if (promise.on_done) promise.on_done(promise.owner);
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  struct promise_type {
+    TranResult result            = TranResult::Change;
+    void* owner                  = nullptr;
+    void (*on_done)(void* owner) = nullptr;
+
+    AsyncResult get_return_object() { return AsyncResult(Handle::from_promise(*this)); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    Final final_suspend() noexcept { return {}; }
+    void return_value(TranResult value) { result = value; }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  AsyncResult(TranResult result)
+      : _handle(nullptr)
+      , _result(result) {}
+
+  AsyncResult(AsyncResult&& other) noexcept
+      : _handle(other._handle)
+      , _result(other._result) {
+    other._handle = nullptr;
+  }
+
+  ~AsyncResult() {
+    if (_handle) _handle.destroy();
+  }
+
+  AsyncResult(const AsyncResult&)            = delete;
+  AsyncResult& operator=(const AsyncResult&) = delete;
+  AsyncResult& operator=(AsyncResult&&)      = delete;
+
+  bool isReady() const { return !_handle || _handle.done(); }
+  TranResult getResult() const { return _handle ? _handle.promise().result : _result; }
+
+  // Hands the suspended coroutine over to the caller, which destroys it once it completes
+  Handle release() {
+    const Handle handle = _handle;
+    _handle             = nullptr;
+    return handle;
+  }
+
+  private:
+  explicit AsyncResult(Handle handle)
+      : _handle(handle)
+      , _result(TranResult::Change) {}
+
+  Handle _handle;
+  TranResult _result;
+};
+
+/**
+ * One-shot awaitable: co_await suspends the hook until set(), which resumes it right away on the
+ * calling task. Call set() from the task that owns the machine, e.g. after polling a driver or
+ * receiving a completion from an ISR. Awaiting a signal already set does not suspend.
+ */
+class AsyncSignal {
+  public:
+  AsyncSignal()
+      : _waiter(nullptr)
+      , _set(false) {}
+
+  AsyncSignal(const AsyncSignal&)            = delete;
+  AsyncSignal& operator=(const AsyncSignal&) = delete;
+
+  bool isSet() const { return _set; }
+  void reset() { _set = false; }
+
+  void set() {
+    _set = true;
+    if (!_waiter) return;
+
+    const std::coroutine_handle<> waiter = _waiter;
+    _waiter                              = nullptr;
+    waiter.resume();
+  }
+
+  bool await_ready() const noexcept { return _set; }
+  void await_suspend(std::coroutine_handle<> waiter) noexcept { _waiter = waiter; }
+  void await_resume() const noexcept {}
+
+  private:
+  std::coroutine_handle<> _waiter;
+  bool _set;
+};
+
+namespace detail {
+template <typename Signature>
+struct AsyncHookOf {
+  using type = std::function<Signature>;
+};
+
+template <typename... Args>
+struct AsyncHookOf<TranResult(Args...)> {
+  using type = std::function<AsyncResult(Args...)>;
+};
+} // namespace detail
+
+// Hook policy of AsyncStateMachine: on_transition returns an AsyncResult, the others are unchanged
+template <typename Signature>
+using AsyncHook = typename detail::AsyncHookOf<Signature>::type;
+
+/**
+ * Flat machine whose on_transition hooks are coroutines (see AsyncResult). When a hook suspends,
+ * dispatch() returns Pending and the machine stays transitioning in its source state, leaving the
+ * dispatching task free to service other machines. Once the hook completes, the exit and enter
+ * hooks run and the state is committed. Events dispatched meanwhile return Deferred (Overflow past
+ * QueueSize) and run in order right after the commit.
+ */
+template <typename StateType, typename EventType, typename Index = LinearIndex,
+  typename Storage = HeapStorage, typename ContextType = Context,
+  size_t QueueSize = STATEFORGE_RTC_QUEUE_SIZE>
+class AsyncStateMachine {
+  public:
+  using State = StateType;
+  using Event = EventType;
+  using Definition =
+    MachineDefinition<StateType, EventType, Index, AsyncHook, Storage, ContextType>;
+  using TransitionType = typename Definition::TransitionType;
+  using DescriptorType = typename Definition::DescriptorType;
+
+  AsyncStateMachine(StateType initial_state, std::initializer_list<TransitionType> transitions)
+      : _definition(initial_state, transitions)
+      , _current_state(initial_state)
+      , _pending(nullptr)
+      , _match(0)
+      , _event() {}
+
+  AsyncStateMachine(StateType initial_state, std::initializer_list<DescriptorType> states,
+    std::initializer_list<TransitionType> transitions)
+      : _definition(initial_state, states, transitions)
+      , _current_state(initial_state)
+      , _pending(nullptr)
+      , _match(0)
+      , _event() {}
+
+  ~AsyncStateMachine() {
+    if (_pending) _pending.destroy();
+  }
+
+  AsyncStateMachine(const AsyncStateMachine&)            = delete;
+  AsyncStateMachine& operator=(const AsyncStateMachine&) = delete;
+
+  TranResult dispatch(EventType event) {
+    if (_rtc.isBusy() || _pending) return defer(event);
+
+    _rtc.setBusy(true);
+    const TranResult result = process(event);
+    drainDeferred();
+
+    _rtc.setBusy(false);
+    return result;
+  }
+
+  bool isTransitioning() const { return static_cast<bool>(_pending); }
+
+  StateType getCurrentState() const { return _current_state; }
+
+  // Refused, returning false, while transitioning: the completion of the hook would commit over it
+  bool resetState() {
+    if (_pending) return false;
+
+    _current_state = _definition.getInitialState();
+    return true;
+  }
+
+  const Definition& getDefinition() const { return _definition; }
+
+  private:
+  using Handle = AsyncResult::Handle;
+
+  TranResult defer(EventType event) {
+    return _rtc.push(event) ? TranResult::Deferred : TranResult::Overflow;
+  }
+
+  // Stops at a hook that suspends, the rest runs once it has completed
+  void drainDeferred() {
+    EventType deferred;
+    while (!_pending && _rtc.pop(deferred))
+      process(deferred);
+  }
+
+  TranResult process(EventType event) {
+    NoMonitor monitor;
+    TranResult result  = TranResult::Change;
+    const size_t match = _definition.select(_current_state, event, result, monitor);
+    if (match == detail::kNoTransition) return result;
+
+    const auto& transition = _definition.getTransition(match);
+    if (!transition.on_transition) return commit(event, match, result);
+
+    AsyncResult hook =
+      transition.on_transition(detail::isAny(transition.from) ? _current_state : transition.from,
+        detail::isAny(transition.event) ? event : transition.event,
+        transition.to,
+        transition.context);
+    if (hook.isReady()) return commit(event, match, hook.getResult());
+
+    _pending                   = hook.release();
+    _pending.promise().owner   = this;
+    _pending.promise().on_done = onCompleted;
+    _match                     = match;
+    _event                     = event;
+    return TranResult::Pending;
+  }
+
+  TranResult commit(EventType event, size_t match, TranResult result) {
+    NoMonitor monitor;
+    StateType state = _current_state;
+    result          = _definition.commit(state, event, match, result, monitor);
+    _current_state  = state;
+    return result;
+  }
+
+  // Called from the final suspension of a hook that had suspended
+  static void onCompleted(void* owner) {
+    AsyncStateMachine& self = *static_cast<AsyncStateMachine*>(owner);
+    const TranResult result = self._pending.promise().result;
+
+    self._pending.destroy();
+    self._pending = nullptr;
+
+    // Busy while committing, so the exit and enter hooks defer their dispatches like in dispatch()
+    const bool nested = self._rtc.isBusy();
+    self._rtc.setBusy(true);
+    self.commit(self._event, self._match, result);
+
+    // Otherwise the dispatch() already running on this machine drains the queue when it returns
+    if (!nested) {
+      self.drainDeferred();
+      self._rtc.setBusy(false);
+    }
+  }
+
+  Definition _definition;
   StateType _current_state;
-  std::vector<Transition<StateType, EventType>> _transitions;
+  Handle _pending;
+  size_t _match;
+  EventType _event;
+  detail::RunToCompletion<EventType, QueueSize> _rtc;
 };
+#endif
 
 } // namespace StateForge
\ No newline at end of file
@@ -0,0 +1,202 @@
+#if defined(ARDUINO)
+  #include <Arduino.h>
+#else
+  #include <chrono>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "StateForge.h"
+
+using namespace StateForge;
+
+/* ---------------------------------------------------------------------------------------------- */
+/*                                        Clock and heap                                          */
+/* ---------------------------------------------------------------------------------------------- */
+// CPU cycles on target, nanoseconds on the host; differences stay correct across a wrap
+#if defined(ARDUINO)
+  #define BENCH_PRINTF    Serial.printf
+  #define BENCH_TICK_UNIT "cycles"
+
+using Ticks = uint32_t;
+
+Ticks now() { return ESP.getCycleCount(); }
+#else
+  #define BENCH_PRINTF    printf
+  #define BENCH_TICK_UNIT "ns"
+
+using Ticks = uint64_t;
+
+Ticks now() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Every allocation is counted, so construction can be reported in bytes of heap
+size_t heap_in_use = 0;
+
+namespace {
+constexpr size_t kHeader = alignof(std::max_align_t);
+}
+
+void* operator new(size_t size) {
+  unsigned char* block = static_cast<unsigned char*>(std::malloc(size + kHeader));
+  if (block == nullptr) std::abort();
+
+  *reinterpret_cast<size_t*>(block) = size;
+  heap_in_use += size;
+  return block + kHeader;
+}
+
+void operator delete(void* pointer) noexcept {
+  if (pointer == nullptr) return;
+
+  unsigned char* block = static_cast<unsigned char*>(pointer) - kHeader;
+  heap_in_use -= *reinterpret_cast<size_t*>(block);
+  std::free(block);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/*                                      Synthetic machines                                        */
+/* ---------------------------------------------------------------------------------------------- */
+// StateCount * EventCount transitions, one per (state, event) pair, each moving to another state
+enum class BenchStates : uint16_t {};
+enum class BenchEvents : uint16_t {};
+
+constexpr size_t kEventCount = 4096;
+constexpr size_t kRounds     = 32;
+
+uint32_t hook_calls = 0;
+
+TranResult countHook(BenchStates from, BenchEvents event, BenchStates to, Context* const context) {
+  hook_calls++;
+  return TranResult::Change;
+}
+
+template <typename TransitionType>
+std::vector<TransitionType> makeTable(size_t state_count, size_t event_count, bool hooked) {
+  std::vector<TransitionType> table;
+  table.reserve(state_count * event_count);
+
+  for (size_t state = 0; state < state_count; state++) {
+    for (size_t event = 0; event < event_count; event++) {
+      table.push_back({static_cast<BenchStates>(state),
+        static_cast<BenchEvents>(event),
+        static_cast<BenchStates>((state + event + 1) % state_count),
+        nullptr,
+        hooked ? countHook : nullptr,
+        nullptr,
+        nullptr,
+        nullptr});
+    }
+  }
+
+  return table;
+}
+
+// Same pseudo-random event sequence for every machine
+std::vector<BenchEvents> makeEvents(size_t event_count) {
+  std::vector<BenchEvents> events(kEventCount);
+  uint32_t seed = 0x12345678;
+
+  for (auto& event : events) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    event = static_cast<BenchEvents>(seed % event_count);
+  }
+
+  return events;
+}
+
+template <typename Machine>
+void run(const char* name, size_t state_count, size_t event_count, bool hooked) {
+  using TransitionType = typename Machine::TransitionType;
+
+  const auto table  = makeTable<TransitionType>(state_count, event_count, hooked);
+  const auto events = makeEvents(event_count);
+
+  const size_t heap_before = heap_in_use;
+  const Ticks built        = now();
+  Machine* machine         = new Machine(static_cast<BenchStates>(0), table.data(), table.size());
+  const Ticks construct    = now() - built;
+  const size_t heap        = heap_in_use - heap_before - sizeof(Machine);
+
+  const Ticks start = now();
+  for (size_t round = 0; round < kRounds; round++) {
+    for (const auto event : events)
+      machine->dispatch(event);
+  }
+  const Ticks elapsed    = now() - start;
+  const double per_event = static_cast<double>(elapsed) / (kRounds * kEventCount);
+
+  BENCH_PRINTF("%-22s %6u %6s %8u %8u %12llu %10.1f\n",
+    name,
+    static_cast<unsigned>(table.size()),
+    hooked ? "yes" : "no",
+    static_cast<unsigned>(sizeof(Machine)),
+    static_cast<unsigned>(heap),
+    static_cast<unsigned long long>(construct),
+    per_event);
+
+  delete machine;
+}
+
+template <size_t StateCount, size_t EventCount>
+void runSize() {
+  using Linear    = StateMachine<BenchStates, BenchEvents>;
+  using Indexed   = IndexedStateMachine<BenchStates, BenchEvents, StateCount, EventCount>;
+  using Delegated = IndexedStateMachine<BenchStates, BenchEvents, StateCount, EventCount, Delegate>;
+
+  for (const bool hooked : {false, true}) {
+    run<Linear>("linear/function", StateCount, EventCount, hooked);
+    run<Indexed>("dense/function", StateCount, EventCount, hooked);
+    run<Delegated>("dense/delegate", StateCount, EventCount, hooked);
+  }
+}
+
+void runAll() {
+  BENCH_PRINTF("%-22s %6s %6s %8s %8s %12s %10s\n",
+    "machine",
+    "size",
+    "hooks",
+    "sizeof",
+    "heap",
+    "construct",
+    "dispatch");
+  BENCH_PRINTF("%-22s %6s %6s %8s %8s %12s %10s\n",
+    "",
+    "",
+    "",
+    "bytes",
+    "bytes",
+    BENCH_TICK_UNIT,
+    BENCH_TICK_UNIT "/ev");
+
+  runSize<2, 2>();
+  runSize<4, 4>();
+  runSize<8, 8>();
+  runSize<16, 16>();
+  runSize<32, 32>();
+
+  BENCH_PRINTF("hook calls: %u\n", static_cast<unsigned>(hook_calls));
+}
+
+#if defined(ARDUINO)
+void setup() {
+  Serial.begin(115200);
+  delay(2000);
+  runAll();
+}
+
+void loop() {}
+#else
+int main() {
+  runAll();
+  return 0;
+}
+#endif
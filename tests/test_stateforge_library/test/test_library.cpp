@@ -104,6 +104,632 @@ StateMachine<States, Events> sm(States::Initial,
     {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
 });
 // clang-format on
+
+// Same machine using the dense (state, event) lookup table
+// clang-format off
+IndexedStateMachine<States, Events, 3, 3> ism(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr,  transitionTo1,    nullptr,  nullptr},
+    {States::State1,  Events::Event2, States::State2,  onEnter1, transitionTo2,    onExit1, &context1},
+    {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
+});
+// clang-format on
+
+// Same machine with a constexpr table living in flash
+// clang-format off
+constexpr StaticTransition<States, Events> static_table[] = {
+  {States::Initial, Events::Event1, States::State1,  nullptr,  transitionTo1,    nullptr,  nullptr},
+  {States::State1,  Events::Event2, States::State2,  onEnter1, transitionTo2,    onExit1, &context1},
+  {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
+};
+// clang-format on
+
+StaticStateMachine<States, Events, 3, static_table> ssm(States::Initial);
+
+// Same machine using allocation-free delegates as hooks
+// clang-format off
+IndexedStateMachine<States, Events, 3, 3, Delegate> dsm(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr,  transitionTo1,    nullptr,  nullptr},
+    {States::State1,  Events::Event2, States::State2,  onEnter1, transitionTo2,    onExit1, &context1},
+    {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
+});
+// clang-format on
+
+// Same machine with inline storage, and with a caller-supplied table
+// clang-format off
+IndexedStateMachine<States, Events, 3, 3, Delegate, InlineStorage<3>> ism_inline(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr,  transitionTo1,    nullptr,  nullptr},
+    {States::State1,  Events::Event2, States::State2,  onEnter1, transitionTo2,    onExit1, &context1},
+    {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
+});
+
+const Transition<States, Events, Delegate> buffer_table[] = {
+  {States::Initial, Events::Event1, States::State1,  nullptr,  transitionTo1,    nullptr,  nullptr},
+  {States::State1,  Events::Event2, States::State2,  onEnter1, transitionTo2,    onExit1, &context1},
+  {States::State2,  Events::Event3, States::Initial, onEnter2, transitionToInit, onExit2, &context2},
+};
+// clang-format on
+
+StateMachine<States, Events, LinearIndex, Delegate, BufferStorage> sm_buffer(States::Initial,
+  buffer_table,
+  3);
+
+// Machine fed through a lock-free event queue
+// clang-format off
+StateMachine<States, Events> sm_queued(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr, nullptr, nullptr, nullptr},
+    {States::State1,  Events::Event2, States::State2,  nullptr, nullptr, nullptr, nullptr},
+    {States::State2,  Events::Event3, States::Initial, nullptr, nullptr, nullptr, nullptr},
+});
+// clang-format on
+
+EventQueue<StateMachine<States, Events>, 4> event_queue(sm_queued);
+
+// Machine whose hooks dispatch events to itself
+extern StateMachine<States, Events> sm_rtc;
+
+States rtc_state_in_hook     = States::State2;
+TranResult rtc_result_in_hook = TranResult::NotFound;
+
+TranResult chainToState2(States from, Events event, States to, Context* const context) {
+  rtc_result_in_hook = sm_rtc.dispatch(Events::Event2);
+  rtc_state_in_hook  = sm_rtc.getCurrentState();
+  return TranResult::Change;
+}
+
+void chainToInitial(States from, Events event, States to, Context* const context) {
+  sm_rtc.dispatch(Events::Event3);
+}
+
+// clang-format off
+StateMachine<States, Events> sm_rtc(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr,        chainToState2, nullptr, nullptr},
+    {States::State1,  Events::Event2, States::State2,  nullptr,        nullptr,       nullptr, nullptr},
+    {States::State2,  Events::Event3, States::Initial, chainToInitial, nullptr,       nullptr, nullptr},
+});
+// clang-format on
+
+// One definition shared by a pool of instances
+extern InstancePool<MachineDefinition<States, Events, DenseIndex<3, 3>>, 4> pool;
+
+size_t pool_entered_instance = 0;
+
+void onPoolEnter(States from, Events event, States to, Context* const context) {
+  pool_entered_instance = pool.getActiveInstance();
+}
+
+// clang-format off
+MachineDefinition<States, Events, DenseIndex<3, 3>> pool_definition(States::Initial,
+  {
+    {States::Initial, Events::Event1, States::State1,  nullptr,     nullptr, nullptr, nullptr},
+    {States::State1,  Events::Event2, States::State2,  nullptr,     nullptr, nullptr, nullptr},
+    {States::State2,  Events::Event3, States::Initial, onPoolEnter, nullptr, nullptr, nullptr},
+});
+// clang-format on
+
+InstancePool<MachineDefinition<States, Events, DenseIndex<3, 3>>, 4> pool(pool_definition);
+
+// Pool of 1-byte states, to go through the table gather of broadcast()
+enum class Links : uint8_t { Idle, Up, Down };
+enum class LinkEvents : uint8_t { Connect, Drop };
+
+uint32_t link_drops = 0;
+
+// When set, the next drop broadcasts more reconnects than the run-to-completion queue holds
+bool link_flooding = false;
+TranResult link_flood[STATEFORGE_RTC_QUEUE_SIZE + 1];
+
+TranResult onLinkDrop(Links from, LinkEvents event, Links to, Context* const context);
+
+// clang-format off
+MachineDefinition<Links, LinkEvents, DenseIndex<3, 2>> link_definition(Links::Idle,
+  {
+    {Links::Idle, LinkEvents::Connect, Links::Up,   nullptr, nullptr,    nullptr, nullptr},
+    {Links::Up,   LinkEvents::Drop,    Links::Down, nullptr, onLinkDrop, nullptr, nullptr},
+    {Links::Down, LinkEvents::Connect, Links::Up,   nullptr, nullptr,    nullptr, nullptr},
+});
+// clang-format on
+
+InstancePool<MachineDefinition<Links, LinkEvents, DenseIndex<3, 2>>, 40> links(link_definition);
+
+TranResult onLinkDrop(Links from, LinkEvents event, Links to, Context* const context) {
+  link_drops++;
+  if (!link_flooding) return TranResult::Change;
+
+  link_flooding = false;
+  for (auto& result : link_flood)
+    result = links.broadcast(LinkEvents::Connect).result;
+
+  return TranResult::Change;
+}
+
+// A table sending beacons past the states of its definition, where no transition applies
+enum class Beacon : uint8_t { Idle, Armed, Lost = 5 };
+enum class BeaconEvents { Lose };
+
+MachineDefinition<Beacon, BeaconEvents, DenseIndex<2, 1>> beacon_definition(Beacon::Idle,
+  {
+    {Beacon::Idle, BeaconEvents::Lose, Beacon::Lost, nullptr, nullptr, nullptr, nullptr},
+  });
+
+InstancePool<MachineDefinition<Beacon, BeaconEvents, DenseIndex<2, 1>>, 16> beacons(
+  beacon_definition);
+
+// Nested states: Idle and Busy are inside On
+enum class Device { Off, On, Idle, Busy, Fault };
+enum class DeviceEvents { Power, Work, Done, Fail, Recover };
+
+char device_log[16];
+size_t device_log_size = 0;
+
+void logDevice(char entry) {
+  if (device_log_size < sizeof(device_log) - 1) device_log[device_log_size++] = entry;
+  device_log[device_log_size] = '\0';
+}
+
+void clearDeviceLog() {
+  device_log_size = 0;
+  device_log[0]   = '\0';
+}
+
+#define DEVICE_HOOK(name, entry)                                                                   \
+  void name(Device from, DeviceEvents event, Device to, Context* const context) { logDevice(entry); }
+
+DEVICE_HOOK(enterOn, 'O')
+DEVICE_HOOK(exitOn, 'o')
+DEVICE_HOOK(enterIdle, 'I')
+DEVICE_HOOK(exitIdle, 'i')
+DEVICE_HOOK(enterBusy, 'B')
+DEVICE_HOOK(exitBusy, 'b')
+
+// clang-format off
+HierarchicalStateMachine<Device, DeviceEvents, 5, 5> hsm(Device::Off,
+  {
+    {Device::Idle, Device::On},
+    {Device::Busy, Device::On},
+  },
+  {
+    {Device::Off,   DeviceEvents::Power,   Device::Idle,  nullptr,   nullptr, nullptr,  nullptr},
+    {Device::On,    DeviceEvents::Fail,    Device::Fault, enterOn,   nullptr, exitOn,   nullptr},
+    {Device::On,    DeviceEvents::Power,   Device::Off,   nullptr,   nullptr, nullptr,  nullptr},
+    {Device::Idle,  DeviceEvents::Work,    Device::Busy,  enterIdle, nullptr, exitIdle, nullptr},
+    {Device::Busy,  DeviceEvents::Done,    Device::Idle,  enterBusy, nullptr, exitBusy, nullptr},
+    {Device::Fault, DeviceEvents::Recover, Device::Off,   nullptr,   nullptr, nullptr,  nullptr},
+});
+// clang-format on
+
+// State descriptors: the same hooks as hsm, declared once per state instead of per transition
+#define DEVICE_STATES                                                                              \
+  {                                                                                                \
+    {Device::Off, nullptr, nullptr, nullptr},                                                      \
+    {Device::On, enterOn, exitOn, nullptr},                                                        \
+    {Device::Idle, enterIdle, exitIdle, nullptr},                                                  \
+    {Device::Busy, enterBusy, exitBusy, nullptr},                                                  \
+  }
+
+// clang-format off
+IndexedStateMachine<Device, DeviceEvents, 5, 5> sm_described(Device::Off, DEVICE_STATES,
+  {
+    {Device::Off,  DeviceEvents::Power, Device::Idle, nullptr, nullptr, nullptr, nullptr},
+    {Device::Idle, DeviceEvents::Work,  Device::Busy, nullptr, nullptr, nullptr, nullptr},
+    {Device::Busy, DeviceEvents::Done,  Device::Idle, nullptr, nullptr, nullptr, nullptr},
+    {Device::Idle, DeviceEvents::Power, Device::Off,  nullptr, nullptr, nullptr, nullptr},
+});
+
+HierarchicalStateMachine<Device, DeviceEvents, 5, 5> hsm_described(Device::Off,
+  {
+    {Device::Idle, Device::On},
+    {Device::Busy, Device::On},
+  },
+  DEVICE_STATES,
+  {
+    {Device::Off,  DeviceEvents::Power, Device::Idle,  nullptr, nullptr, nullptr, nullptr},
+    {Device::On,   DeviceEvents::Fail,  Device::Fault, nullptr, nullptr, nullptr, nullptr},
+    {Device::Idle, DeviceEvents::Work,  Device::Busy,  nullptr, nullptr, nullptr, nullptr},
+});
+// clang-format on
+
+// History: Verse and Chorus are inside Track2, both tracks inside Playing, which has a shallow and
+// a deep history pseudo-state
+enum class Player { Off, Playing, Track1, Track2, Verse, Chorus, Shallow, Deep };
+enum class PlayerEvents { Play, Next, Pause, Resume, ResumeDeep };
+
+// clang-format off
+HierarchicalStateMachine<Player, PlayerEvents, 8, 5> player(Player::Off,
+  {
+    {Player::Track1,  Player::Playing},
+    {Player::Track2,  Player::Playing},
+    {Player::Verse,   Player::Track2},
+    {Player::Chorus,  Player::Track2},
+    {Player::Shallow, Player::Playing, HistoryKind::Shallow},
+    {Player::Deep,    Player::Playing, HistoryKind::Deep},
+  },
+  {
+    {Player::Off,     PlayerEvents::Play,       Player::Track1,  nullptr, nullptr, nullptr, nullptr},
+    {Player::Track1,  PlayerEvents::Next,       Player::Verse,   nullptr, nullptr, nullptr, nullptr},
+    {Player::Verse,   PlayerEvents::Next,       Player::Chorus,  nullptr, nullptr, nullptr, nullptr},
+    {Player::Playing, PlayerEvents::Pause,      Player::Off,     nullptr, nullptr, nullptr, nullptr},
+    {Player::Off,     PlayerEvents::Resume,     Player::Shallow, nullptr, nullptr, nullptr, nullptr},
+    {Player::Off,     PlayerEvents::ResumeDeep, Player::Deep,    nullptr, nullptr, nullptr, nullptr},
+});
+// clang-format on
+
+// Event policies: Connect bursts are coalesced, only the latest Sample is logged, and Send waits
+// for the link to be up
+enum class Uplink { Down, Up };
+enum class UplinkEvents { Connect, Drop, Sample, Send };
+
+size_t link_connects = 0;
+size_t link_samples  = 0;
+size_t link_sends    = 0;
+int link_level       = 0;
+
+TranResult onLinkEvent(Uplink from, UplinkEvents event, Uplink to, Context* const context);
+
+StateMachine<Uplink, UplinkEvents> uplink(Uplink::Down,
+  {
+    {Uplink::Down, UplinkEvents::Connect, Uplink::Up, nullptr, onLinkEvent, nullptr, nullptr},
+    {Uplink::Up, UplinkEvents::Drop, Uplink::Down, nullptr, nullptr, nullptr, nullptr},
+    {Uplink::Down, UplinkEvents::Sample, Uplink::Down, nullptr, onLinkEvent, nullptr, nullptr},
+    {Uplink::Up, UplinkEvents::Sample, Uplink::Up, nullptr, onLinkEvent, nullptr, nullptr},
+    {Uplink::Up, UplinkEvents::Send, Uplink::Up, nullptr, onLinkEvent, nullptr, nullptr},
+  });
+
+PolicyQueue<decltype(uplink), 8, 2, 4, int> uplink_queue(uplink);
+
+TranResult onLinkEvent(Uplink from, UplinkEvents event, Uplink to, Context* const context) {
+  if (event == UplinkEvents::Connect) link_connects++;
+  if (event == UplinkEvents::Send) link_sends++;
+
+  if (event == UplinkEvents::Sample) {
+    link_samples++;
+    link_level = *uplink.getPayload<int>();
+  }
+
+  return TranResult::Change;
+}
+
+// Guards: Toggle picks its target from the pressure, and Open only closes when it is safe
+enum class Valve { Closed, Open, Locked };
+enum class ValveEvents { Toggle };
+
+int valve_pressure     = 0;
+size_t valve_closings  = 0;
+
+bool isSafe(Valve from, ValveEvents event, Valve to, Context* const context) noexcept {
+  return valve_pressure < 10;
+}
+
+bool isHigh(Valve from, ValveEvents event, Valve to, Context* const context) noexcept {
+  return valve_pressure >= 10;
+}
+
+TranResult onValveClose(Valve from, ValveEvents event, Valve to, Context* const context) {
+  valve_closings++;
+  return TranResult::Change;
+}
+
+#define VALVE_TRANSITIONS                                                                          \
+  {                                                                                                \
+    {Valve::Closed, ValveEvents::Toggle, Valve::Open, nullptr, nullptr, nullptr, nullptr, isSafe}, \
+    {Valve::Closed, ValveEvents::Toggle, Valve::Locked, nullptr, nullptr, nullptr, nullptr,        \
+      isHigh},                                                                                     \
+    {Valve::Open, ValveEvents::Toggle, Valve::Closed, nullptr, onValveClose, nullptr, nullptr,     \
+      isSafe},                                                                                     \
+  }
+
+StateMachine<Valve, ValveEvents> sm_valve(Valve::Closed, VALVE_TRANSITIONS);
+IndexedStateMachine<Valve, ValveEvents, 3, 1> ism_valve(Valve::Closed, VALVE_TRANSITIONS);
+StateMachine<Valve, ValveEvents, PackedIndex<3, 1, 3>> pm_valve(Valve::Closed, VALVE_TRANSITIONS);
+
+StateMachine<Valve, ValveEvents, LinearIndex, std::function, HeapStorage, StatsMonitor<3, 3, 1>>
+  sm_monitored(Valve::Closed, VALVE_TRANSITIONS);
+
+StateMachine<Valve, ValveEvents, LinearIndex, std::function, HeapStorage, TraceMonitor<4>>
+  sm_traced(Valve::Closed, VALVE_TRANSITIONS);
+
+// Typed context: hooks receive a Motor directly, without a Context base or an is<>() check
+struct Motor {
+  uint32_t speed;
+};
+
+Motor valve_motor = {0};
+
+void onMotorOpen(Valve from, ValveEvents event, Valve to, Motor* const motor) {
+  motor->speed = 100;
+}
+
+void onMotorClose(Valve from, ValveEvents event, Valve to, Motor* const motor) {
+  motor->speed = 0;
+}
+
+// clang-format off
+IndexedStateMachine<Valve, ValveEvents, 3, 1, std::function, HeapStorage, NoMonitor, Motor>
+  ism_motor(Valve::Closed, {
+    {Valve::Closed, ValveEvents::Toggle, Valve::Open,   onMotorClose, nullptr, nullptr, &valve_motor},
+    {Valve::Open,   ValveEvents::Toggle, Valve::Closed, onMotorOpen,  nullptr, nullptr, &valve_motor},
+});
+// clang-format on
+
+// Timed transitions: Connecting gives up after 5000 ticks, Up and Busy are inside Online and
+// inherit its 20000 ticks keepalive
+enum class Net { Idle, Connecting, Online, Up, Busy };
+enum class NetEvents { Connect, Connected, Timeout, Keepalive, Transfer };
+
+TimerWheel net_wheel;
+
+#define NET_TRANSITIONS                                                                            \
+  {                                                                                                \
+    {Net::Idle, NetEvents::Connect, Net::Connecting, nullptr, nullptr, nullptr, nullptr},          \
+    {Net::Connecting, NetEvents::Connected, Net::Up, nullptr, nullptr, nullptr, nullptr},          \
+    {Net::Connecting, NetEvents::Timeout, Net::Idle, nullptr, nullptr, nullptr, nullptr, nullptr,  \
+      5000},                                                                                       \
+    {Net::Online, NetEvents::Keepalive, Net::Idle, nullptr, nullptr, nullptr, nullptr, nullptr,    \
+      20000},                                                                                      \
+    {Net::Up, NetEvents::Transfer, Net::Busy, nullptr, nullptr, nullptr, nullptr},                 \
+    {Net::Busy, NetEvents::Transfer, Net::Up, nullptr, nullptr, nullptr, nullptr},                 \
+  }
+
+IndexedStateMachine<Net, NetEvents, 5, 5> ism_net(Net::Idle, NET_TRANSITIONS);
+HierarchicalStateMachine<Net, NetEvents, 5, 5> hsm_net(Net::Idle,
+  {{Net::Up, Net::Online}, {Net::Busy, Net::Online}}, NET_TRANSITIONS);
+
+MachineTimer<IndexedStateMachine<Net, NetEvents, 5, 5>> ism_net_timer(net_wheel, ism_net);
+MachineTimer<HierarchicalStateMachine<Net, NetEvents, 5, 5>> hsm_net_timer(net_wheel, hsm_net);
+
+constexpr StaticTransition<Valve, ValveEvents> valve_table[] = VALVE_TRANSITIONS;
+StaticStateMachine<Valve, ValveEvents, 3, valve_table> ssm_valve(Valve::Closed);
+
+// Binary table: the valve table with hook IDs, encoded into an image and dispatched in place
+using ValveImage = BinaryDefinition<Valve, ValveEvents>;
+constexpr uint8_t kNoHook = ValveImage::kNoHook;
+
+const ValveImage::EntryType valve_entries[] = {
+  {Valve::Closed, ValveEvents::Toggle, Valve::Open, kNoHook, kNoHook, kNoHook, 0, kNoHook, 0},
+  {Valve::Closed, ValveEvents::Toggle, Valve::Locked, kNoHook, kNoHook, kNoHook, 1, kNoHook, 0},
+  {Valve::Open, ValveEvents::Toggle, Valve::Closed, kNoHook, 0, kNoHook, 0, kNoHook, 0},
+};
+
+const StaticTransition<Valve, ValveEvents>::TransitionHook valve_transition_hooks[] = {
+  onValveClose};
+const StaticTransition<Valve, ValveEvents>::Guard valve_guards[] = {isSafe, isHigh};
+const BinaryHooks<Valve, ValveEvents> valve_hooks = {
+  nullptr, 0, valve_transition_hooks, 1, nullptr, 0, valve_guards, 2, nullptr, 0};
+
+uint8_t valve_image[ValveImage::imageSize(3)];
+const size_t valve_image_size =
+  ValveImage::encode(Valve::Closed, 3, valve_entries, 3, valve_image, sizeof(valve_image));
+BinaryStateMachine<Valve, ValveEvents> bsm_valve(valve_image, valve_image_size, valve_hooks);
+
+// Wildcards: Fault from any state, and any event while running
+enum class Modes { Idle, Run, Error };
+enum class ModeEvents { Start, Stop, Fault, Clear };
+
+ModeEvents run_event = ModeEvents::Clear;
+
+TranResult onRunEvent(Modes from, ModeEvents event, Modes to, Context* const context) {
+  run_event = event;
+  return TranResult::NoChange;
+}
+
+#define MODE_TRANSITIONS                                                                           \
+  {                                                                                                \
+    {any<Modes>(), ModeEvents::Fault, Modes::Error, nullptr, nullptr, nullptr, nullptr},           \
+    {Modes::Run, any<ModeEvents>(), Modes::Run, nullptr, onRunEvent, nullptr, nullptr},            \
+    {Modes::Idle, ModeEvents::Start, Modes::Run, nullptr, nullptr, nullptr, nullptr},              \
+    {Modes::Run, ModeEvents::Stop, Modes::Idle, nullptr, nullptr, nullptr, nullptr},               \
+    {Modes::Error, ModeEvents::Clear, Modes::Idle, nullptr, nullptr, nullptr, nullptr},            \
+  }
+
+StateMachine<Modes, ModeEvents> sm_modes(Modes::Idle, MODE_TRANSITIONS);
+IndexedStateMachine<Modes, ModeEvents, 3, 4> ism_modes(Modes::Idle, MODE_TRANSITIONS);
+StateMachine<Modes, ModeEvents, PackedIndex<3, 4, 8>> pm_modes(Modes::Idle, MODE_TRANSITIONS);
+
+// Compact encoding: a table of up to 254 transitions gets one byte slots, and keys stay two bytes
+static_assert(sizeof(DenseIndex<3, 4, 32>) * 2 == sizeof(DenseIndex<3, 4>), "");
+static_assert(sizeof(PackedIndex<3, 4, 8>) == 8 * 2 + sizeof(size_t), "");
+
+// Replay: one machine records, a second one over the same table replays; Fault chains a Clear
+using ReplayMachine =
+  StateMachine<Modes, ModeEvents, LinearIndex, std::function, HeapStorage, TraceMonitor<16>>;
+
+extern ReplayMachine* replay_target;
+
+TranResult onFaultRaised(Modes from, ModeEvents event, Modes to, Context* const context) {
+  replay_target->dispatch(ModeEvents::Clear);
+  return TranResult::Change;
+}
+
+#define REPLAY_TRANSITIONS                                                                         \
+  {                                                                                                \
+    {any<Modes>(), ModeEvents::Fault, Modes::Error, nullptr, onFaultRaised, nullptr, nullptr},     \
+    {Modes::Idle, ModeEvents::Start, Modes::Run, nullptr, nullptr, nullptr, nullptr},              \
+    {Modes::Run, ModeEvents::Stop, Modes::Idle, nullptr, nullptr, nullptr, nullptr},               \
+    {Modes::Error, ModeEvents::Clear, Modes::Idle, nullptr, nullptr, nullptr, nullptr},            \
+  }
+
+ReplayMachine replay_recorder(Modes::Idle, REPLAY_TRANSITIONS);
+ReplayMachine replay_player(Modes::Idle, REPLAY_TRANSITIONS);
+ReplayMachine* replay_target = &replay_recorder;
+
+// Graph export, with the hit counts of its own monitor
+StateMachine<Modes, ModeEvents, LinearIndex, std::function, HeapStorage, StatsMonitor<5, 3, 4>>
+  sm_modes_graph(Modes::Idle, MODE_TRANSITIONS);
+
+const char* modeName(Modes mode) {
+  static const char* const names[] = {"Idle", "Run", "Error"};
+  return names[static_cast<size_t>(mode)];
+}
+
+const char* modeEventName(ModeEvents event) {
+  static const char* const names[] = {"Start", "Stop", "Fault", "Clear"};
+  return names[static_cast<size_t>(event)];
+}
+
+// Table validation: Fault never fires, Idle and Run both handle it first, and Error is dead
+#define FLAWED_TRANSITIONS                                                                         \
+  {                                                                                                \
+    {Modes::Idle, ModeEvents::Start, Modes::Run, nullptr, nullptr, nullptr, nullptr},              \
+    {Modes::Idle, ModeEvents::Fault, Modes::Idle, nullptr, nullptr, nullptr, nullptr},             \
+    {Modes::Run, any<ModeEvents>(), Modes::Idle, nullptr, nullptr, nullptr, nullptr},              \
+    {any<Modes>(), ModeEvents::Fault, Modes::Error, nullptr, nullptr, nullptr, nullptr},           \
+  }
+
+constexpr StaticTransition<Modes, ModeEvents> flawed_table[] = FLAWED_TRANSITIONS;
+using FlawedMachine = StaticStateMachine<Modes, ModeEvents, 4, flawed_table>;
+
+static_assert(FlawedMachine::validate(Modes::Idle).issue == TableIssue::Shadowed, "");
+static_assert(FlawedMachine::validate(Modes::Idle).entry == 3, "");
+static_assert(FlawedMachine::validate(Modes::Error).issue == TableIssue::DeadState, "");
+static_assert(StaticStateMachine<Valve, ValveEvents, 3, valve_table>::validate(Valve::Closed)
+                  .issue == TableIssue::None,
+  "");
+
+StateMachine<Modes, ModeEvents> sm_flawed(Modes::Idle, FLAWED_TRANSITIONS);
+
+// Orthogonal regions: power and radio share the system events, nothing handles Tick
+enum class Power { Awake, Asleep };
+enum class Radio { Off, Joining, Joined };
+enum class SystemEvents { Sleep, Wake, Join, Tick };
+
+HierarchicalStateMachine<Power, SystemEvents, 2, 4> power(Power::Awake,
+  {},
+  {
+    {Power::Awake, SystemEvents::Sleep, Power::Asleep, nullptr, nullptr, nullptr, nullptr},
+    {Power::Asleep, SystemEvents::Wake, Power::Awake, nullptr, nullptr, nullptr, nullptr},
+  });
+
+StateMachine<Radio, SystemEvents> radio(Radio::Off,
+  {
+    {Radio::Off, SystemEvents::Join, Radio::Joining, nullptr, nullptr, nullptr, nullptr},
+    {Radio::Joining, SystemEvents::Join, Radio::Joined, nullptr, nullptr, nullptr, nullptr},
+    {any<Radio>(), SystemEvents::Sleep, Radio::Off, nullptr, nullptr, nullptr, nullptr},
+  });
+
+ParallelMachine<4, decltype(power), decltype(radio)> system_regions(power, radio);
+
+// Executor: both queues live on worker 0, worker 1 steals when worker 0 is behind
+EventQueue<decltype(power), 4> power_queue(power);
+EventQueue<decltype(radio), 4> radio_queue(radio);
+Executor<2, 2> executor(1);
+
+// Payloads: frames reach the hook by reference, from the caller or straight from a queue cell
+struct Frame {
+  uint8_t length;
+  uint8_t data[8];
+};
+
+enum class Parser { Waiting, Parsed };
+enum class ParserEvents { Frame, Reset };
+
+const Frame* parsed_frame = nullptr;
+
+TranResult onFrame(Parser from, ParserEvents event, Parser to, Context* const context);
+
+StateMachine<Parser, ParserEvents> parser(Parser::Waiting,
+  {
+    {Parser::Waiting, ParserEvents::Frame, Parser::Parsed, nullptr, onFrame, nullptr, nullptr},
+    {Parser::Parsed, ParserEvents::Reset, Parser::Waiting, nullptr, nullptr, nullptr, nullptr},
+  });
+
+EventQueue<decltype(parser), 4, Frame> frame_queue(parser);
+
+TranResult onFrame(Parser from, ParserEvents event, Parser to, Context* const context) {
+  parsed_frame = parser.getPayload<Frame>();
+  return (parsed_frame && (parsed_frame->length > 0)) ? TranResult::Change : TranResult::NoChange;
+}
+
+// A hook passing a payload on to its own machine, as a temporary
+enum class Relay { Idle, Armed, Sent };
+enum class RelayEvents { Arm, Send };
+
+struct Burst {
+  uint8_t data[32];
+};
+
+TranResult relay_sent  = TranResult::NoChange;
+TranResult relay_burst = TranResult::NoChange;
+int relay_value        = 0;
+
+TranResult onRelayArm(Relay from, RelayEvents event, Relay to, Context* const context);
+TranResult onRelaySend(Relay from, RelayEvents event, Relay to, Context* const context);
+
+StateMachine<Relay, RelayEvents> relay(Relay::Idle,
+  {
+    {Relay::Idle, RelayEvents::Arm, Relay::Armed, nullptr, onRelayArm, nullptr, nullptr},
+    {Relay::Armed, RelayEvents::Send, Relay::Sent, nullptr, onRelaySend, nullptr, nullptr},
+  });
+
+TranResult onRelayArm(Relay from, RelayEvents event, Relay to, Context* const context) {
+  relay_sent  = relay.dispatch(RelayEvents::Send, 40 + 2);
+  relay_burst = relay.dispatch(RelayEvents::Send, Burst());
+  return TranResult::Change;
+}
+
+TranResult onRelaySend(Relay from, RelayEvents event, Relay to, Context* const context) {
+  const int* value = relay.getPayload<int>();
+  relay_value      = value ? *value : -1;
+  return TranResult::Change;
+}
+
+// Async hooks (C++20): reading the sensor waits for the I2C transfer to complete
+#if defined(__cpp_impl_coroutine)
+enum class Sensor { Idle, Ready };
+enum class SensorEvents { Read, Clear };
+
+AsyncSignal i2c_done;
+
+AsyncResult readSensor(Sensor from, SensorEvents event, Sensor to, Context* const context) {
+  co_await i2c_done;
+  co_return TranResult::Change;
+}
+
+AsyncStateMachine<Sensor, SensorEvents> sensor(Sensor::Idle,
+  {
+    {Sensor::Idle, SensorEvents::Read, Sensor::Ready, nullptr, readSensor, nullptr, nullptr},
+    {Sensor::Ready, SensorEvents::Clear, Sensor::Idle, nullptr, nullptr, nullptr, nullptr},
+  });
+
+// Entering Sampled once the ADC read completes stores the sample right away
+enum class Probe { Idle, Sampled, Stored };
+enum class ProbeEvents { Sample, Store };
+
+AsyncSignal adc_done;
+TranResult probe_store = TranResult::NoChange;
+
+AsyncResult sampleProbe(Probe from, ProbeEvents event, Probe to, Context* const context) {
+  co_await adc_done;
+  co_return TranResult::Change;
+}
+
+void onProbeSampled(Probe from, ProbeEvents event, Probe to, Context* const context);
+
+AsyncStateMachine<Probe, ProbeEvents> probe(Probe::Idle,
+  {
+    {Probe::Idle, ProbeEvents::Sample, Probe::Sampled, nullptr, sampleProbe, nullptr, nullptr},
+    {Probe::Sampled, ProbeEvents::Store, Probe::Stored, onProbeSampled, nullptr, nullptr, nullptr},
+  });
+
+void onProbeSampled(Probe from, ProbeEvents event, Probe to, Context* const context) {
+  probe_store = probe.dispatch(ProbeEvents::Store);
+}
+#endif
+
+// Member function bound to a delegate
+struct ResetCounter {
+  uint32_t calls;
+
+  TranResult onTransition(States from, Events event, States to, Context* const context) {
+    calls++;
+    return TranResult::Reset;
+  }
+};
+
+ResetCounter reset_counter = {0};
 /* ---------------------------------------------------------------------------------------------- */
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -220,6 +846,833 @@ void testContextType() {
   TEST_ASSERT_TRUE(ctx_ptr->is<Context1>());
   TEST_ASSERT_FALSE(ctx_ptr->is<Context2>());
 }
+
+// Test 8: verify the indexed machine follows the same transitions as the linear one
+void testIndexedTransitions() {
+  TEST_ASSERT_EQUAL(States::Initial, ism.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::NotFound, ism.dispatch(Events::Event2));
+  TEST_ASSERT_EQUAL(TranResult::Change, ism.dispatch(Events::Event1));
+  TEST_ASSERT_EQUAL(States::State1, ism.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_ENTER_VALUE, context1.positive_int);
+
+  TEST_ASSERT_EQUAL(TranResult::NotFound, ism.dispatch(Events::Event3));
+  TEST_ASSERT_EQUAL(TranResult::Change, ism.dispatch(Events::Event2));
+  TEST_ASSERT_EQUAL(States::State2, ism.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_EXIT_VALUE, context1.positive_int);
+  TEST_ASSERT_EQUAL(CONTEXT2_ON_ENTER_VALUE, context2.negative_int);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, ism.dispatch(Events::Event3));
+  TEST_ASSERT_EQUAL(States::Initial, ism.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT2_ON_EXIT_VALUE, context2.negative_int);
+}
+
+// Test 9: verify the static machine follows the same transitions as the runtime one
+void testStaticTransitions() {
+  TEST_ASSERT_EQUAL(States::Initial, ssm.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::NotFound, ssm.dispatch(Events::Event2));
+  TEST_ASSERT_EQUAL(TranResult::Change, ssm.dispatch(Events::Event1));
+  TEST_ASSERT_EQUAL(States::State1, ssm.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_ENTER_VALUE, context1.positive_int);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, ssm.dispatch(Events::Event2));
+  TEST_ASSERT_EQUAL(States::State2, ssm.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_EXIT_VALUE, context1.positive_int);
+  TEST_ASSERT_EQUAL(CONTEXT2_ON_ENTER_VALUE, context2.negative_int);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, ssm.dispatch(Events::Event3));
+  TEST_ASSERT_EQUAL(States::Initial, ssm.getCurrentState());
+  TEST_ASSERT_EQUAL(CONTEXT2_ON_EXIT_VALUE, context2.negative_int);
+
+  TEST_ASSERT_EQUAL_PTR(&context1, ssm.getContext(States::State1, Events::Event2, States::State2));
+}
+
+// Test 10: verify delegate hooks, including a bound member function
+void testDelegateHooks() {
+  TEST_ASSERT_EQUAL(TranResult::Change, dsm.dispatch(Events::Event1));
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_ENTER_VALUE, context1.positive_int);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, dsm.dispatch(Events::Event2));
+  TEST_ASSERT_EQUAL(CONTEXT1_ON_EXIT_VALUE, context1.positive_int);
+  TEST_ASSERT_EQUAL(CONTEXT2_ON_ENTER_VALUE, context2.negative_int);
+  TEST_ASSERT_EQUAL(States::State2, dsm.getCurrentState());
+
+  using Hook = Delegate<TranResult(States, Events, States, Context* const)>;
+  Hook hook  = Hook::bind<ResetCounter, &ResetCounter::onTransition>(&reset_counter);
+
+  TEST_ASSERT_TRUE(static_cast<bool>(hook));
+  TEST_ASSERT_FALSE(static_cast<bool>(Hook()));
+  TranResult result = hook(States::State1, Events::Event1, States::State2, nullptr);
+  TEST_ASSERT_EQUAL(TranResult::Reset, result);
+  TEST_ASSERT_EQUAL(1, reset_counter.calls);
+  TEST_ASSERT_EQUAL(sizeof(void*) * 2, sizeof(Hook));
+}
+
+// Test 11: verify inline and buffer storage machines run the full cycle
+void testFixedStorage() {
+  const Events cycle[] = {Events::Event1, Events::Event2, Events::Event3};
+  const States states[] = {States::State1, States::State2, States::Initial};
+
+  for (size_t i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(TranResult::Change, ism_inline.dispatch(cycle[i]));
+    TEST_ASSERT_EQUAL(states[i], ism_inline.getCurrentState());
+
+    TEST_ASSERT_EQUAL(TranResult::Change, sm_buffer.dispatch(cycle[i]));
+    TEST_ASSERT_EQUAL(states[i], sm_buffer.getCurrentState());
+  }
+
+  TEST_ASSERT_EQUAL(TranResult::NotFound, sm_buffer.dispatch(Events::Event3));
+  TEST_ASSERT_EQUAL_PTR(&context2,
+    ism_inline.getContext(States::State2, Events::Event3, States::Initial));
+}
+
+// Test 12: verify posted events are only dispatched by processPending, in order and in batches
+void testEventQueue() {
+  TEST_ASSERT_TRUE(event_queue.isEmpty());
+  TEST_ASSERT_TRUE(event_queue.post(Events::Event1));
+  TEST_ASSERT_TRUE(event_queue.post(Events::Event2));
+  TEST_ASSERT_TRUE(event_queue.post(Events::Event3));
+  TEST_ASSERT_TRUE(event_queue.post(Events::Event1));
+  TEST_ASSERT_FALSE(event_queue.post(Events::Event2));
+  TEST_ASSERT_EQUAL(States::Initial, sm_queued.getCurrentState());
+
+  TEST_ASSERT_EQUAL(2, event_queue.processPending(2));
+  TEST_ASSERT_EQUAL(States::State2, sm_queued.getCurrentState());
+
+  TEST_ASSERT_EQUAL(2, event_queue.processPending());
+  TEST_ASSERT_EQUAL(States::State1, sm_queued.getCurrentState());
+  TEST_ASSERT_TRUE(event_queue.isEmpty());
+  TEST_ASSERT_EQUAL(0, event_queue.processPending());
+
+  // Slots are reusable after draining
+  TEST_ASSERT_TRUE(event_queue.post(Events::Event2));
+  TEST_ASSERT_EQUAL(1, event_queue.processPending());
+  TEST_ASSERT_EQUAL(States::State2, sm_queued.getCurrentState());
+}
+
+// Test 13: verify events dispatched from hooks run after the current transition is committed
+void testRunToCompletion() {
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_rtc.dispatch(Events::Event1));
+
+  // Inside the hook the event was queued and the state not yet committed
+  TEST_ASSERT_EQUAL(TranResult::Deferred, rtc_result_in_hook);
+  TEST_ASSERT_EQUAL(States::Initial, rtc_state_in_hook);
+
+  // The queued Event2 then ran, and State2's on_enter hook queued Event3
+  TEST_ASSERT_EQUAL(States::Initial, sm_rtc.getCurrentState());
+}
+
+// Test 14: verify batch dispatch runs every event and honors the stop mask
+void testDispatchAll() {
+  const Events events[] = {Events::Event1, Events::Event2, Events::Event3, Events::Event3,
+    Events::Event1};
+
+  // Without a stop mask all events are processed (the second Event3 is NotFound)
+  sm_queued.resetState();
+  BatchResult batch = sm_queued.dispatchAll(events, 5);
+  TEST_ASSERT_EQUAL(5, batch.processed);
+  TEST_ASSERT_EQUAL(TranResult::Change, batch.result);
+  TEST_ASSERT_EQUAL(States::State1, sm_queued.getCurrentState());
+
+  sm_queued.resetState();
+  batch = sm_queued.dispatchAll(events, 5, TranResult::NotFound | TranResult::InvalidContext);
+  TEST_ASSERT_EQUAL(4, batch.processed);
+  TEST_ASSERT_EQUAL(TranResult::NotFound, batch.result);
+  TEST_ASSERT_EQUAL(States::Initial, sm_queued.getCurrentState());
+
+  batch = sm_queued.dispatchAll(events, 0);
+  TEST_ASSERT_EQUAL(0, batch.processed);
+}
+
+// Test 15: verify pool instances share the table but keep independent states
+void testInstancePool() {
+  TEST_ASSERT_EQUAL(4, pool.size());
+
+  TEST_ASSERT_EQUAL(TranResult::Change, pool.dispatch(2, Events::Event1));
+  TEST_ASSERT_EQUAL(TranResult::Change, pool.dispatch(0, Events::Event1));
+  TEST_ASSERT_EQUAL(TranResult::NotFound, pool.dispatch(1, Events::Event2));
+  TEST_ASSERT_EQUAL(TranResult::NotFound, pool.dispatch(4, Events::Event1));
+
+  const States expected[] = {States::State1, States::Initial, States::State1, States::Initial};
+  for (size_t i = 0; i < 4; i++)
+    TEST_ASSERT_EQUAL(expected[i], pool.getStates()[i]);
+
+  // The enter hook of State2 reports the instance it runs for
+  TEST_ASSERT_EQUAL(TranResult::Change, pool.dispatch(2, Events::Event2));
+  TEST_ASSERT_EQUAL(2, pool_entered_instance);
+  TEST_ASSERT_EQUAL(States::State2, pool.getCurrentState(2));
+
+  pool.resetAll();
+  TEST_ASSERT_EQUAL(States::Initial, pool.getCurrentState(2));
+}
+
+// Test 16: verify broadcast matches per-instance dispatch, with and without hooks
+void testBroadcast() {
+  TEST_ASSERT_EQUAL(40, links.broadcast(LinkEvents::Connect).matched);
+  TEST_ASSERT_EQUAL(0, links.broadcast(LinkEvents::Connect).matched);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, links.dispatch(3, LinkEvents::Drop));
+  TEST_ASSERT_EQUAL(TranResult::Change, links.dispatch(35, LinkEvents::Drop));
+  TEST_ASSERT_EQUAL(2, link_drops);
+
+  // Only the two dropped links reconnect
+  TEST_ASSERT_EQUAL(2, links.broadcast(LinkEvents::Connect).matched);
+  TEST_ASSERT_EQUAL(Links::Up, links.getCurrentState(3));
+
+  // Every instance runs the on_transition hook
+  const BroadcastResult dropped = links.broadcast(LinkEvents::Drop);
+  TEST_ASSERT_EQUAL(40, dropped.matched);
+  TEST_ASSERT_EQUAL(TranResult::Change, dropped.result);
+  TEST_ASSERT_EQUAL(42, link_drops);
+
+  for (size_t i = 0; i < links.size(); i++)
+    TEST_ASSERT_EQUAL(Links::Down, links.getCurrentState(i));
+
+  // Broadcasts from a hook are queued, and the one past the queue is reported as lost
+  TEST_ASSERT_EQUAL(TranResult::Change, links.dispatch(0, LinkEvents::Connect));
+  link_flooding = true;
+  TEST_ASSERT_EQUAL(TranResult::Change, links.dispatch(0, LinkEvents::Drop));
+  TEST_ASSERT_EQUAL(TranResult::Deferred, link_flood[0]);
+  TEST_ASSERT_EQUAL(TranResult::Deferred, link_flood[STATEFORGE_RTC_QUEUE_SIZE - 1]);
+  TEST_ASSERT_EQUAL(TranResult::Overflow, link_flood[STATEFORGE_RTC_QUEUE_SIZE]);
+
+  for (size_t i = 0; i < links.size(); i++)
+    TEST_ASSERT_EQUAL(Links::Up, links.getCurrentState(i));
+
+  // Instances in a state past the definition stay there, with or without SIMD gathers
+  TEST_ASSERT_EQUAL(16, beacons.broadcast(BeaconEvents::Lose).matched);
+  TEST_ASSERT_EQUAL(0, beacons.broadcast(BeaconEvents::Lose).matched);
+  for (size_t i = 0; i < beacons.size(); i++)
+    TEST_ASSERT_EQUAL(Beacon::Lost, beacons.getCurrentState(i));
+}
+
+// Test 17: verify events bubble to parents and exit/enter run along the common ancestor path
+void testHierarchicalStates() {
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL(Device::Idle, hsm.getCurrentState());
+  TEST_ASSERT_TRUE(hsm.isInState(Device::On));
+  TEST_ASSERT_EQUAL_STRING("OI", device_log);
+
+  // Sibling transition: On is neither exited nor entered
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm.dispatch(DeviceEvents::Work));
+  TEST_ASSERT_EQUAL_STRING("iB", device_log);
+
+  // Fail is only handled by On, exiting Busy first
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm.dispatch(DeviceEvents::Fail));
+  TEST_ASSERT_EQUAL(Device::Fault, hsm.getCurrentState());
+  TEST_ASSERT_FALSE(hsm.isInState(Device::On));
+  TEST_ASSERT_EQUAL_STRING("bo", device_log);
+
+  TEST_ASSERT_EQUAL(TranResult::NotFound, hsm.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm.dispatch(DeviceEvents::Recover));
+
+  // Power from Idle bubbles to On, Idle runs its own exit hook
+  hsm.dispatch(DeviceEvents::Power);
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL(Device::Off, hsm.getCurrentState());
+  TEST_ASSERT_EQUAL_STRING("i", device_log);
+}
+
+// Test 18: verify wildcard priorities: exact, then any event, then any state
+template <typename Machine>
+void checkWildcards(Machine& machine) {
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ModeEvents::Fault));
+  TEST_ASSERT_EQUAL(Modes::Error, machine.getCurrentState());
+  TEST_ASSERT_EQUAL(TranResult::NotFound, machine.dispatch(ModeEvents::Start));
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ModeEvents::Clear));
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ModeEvents::Start));
+
+  // Run handles every event itself, so Fault does not reach the any state entry
+  TEST_ASSERT_EQUAL(TranResult::NoChange, machine.dispatch(ModeEvents::Fault));
+  TEST_ASSERT_EQUAL(ModeEvents::Fault, run_event);
+  TEST_ASSERT_EQUAL(Modes::Run, machine.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ModeEvents::Stop));
+  TEST_ASSERT_EQUAL(Modes::Idle, machine.getCurrentState());
+}
+
+void testWildcards() {
+  checkWildcards(sm_modes);
+  checkWildcards(ism_modes);
+  checkWildcards(pm_modes);
+}
+
+// Test 19: verify state descriptor hooks run on every enter and exit, flat and nested
+void testStateDescriptors() {
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_described.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_described.dispatch(DeviceEvents::Work));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_described.dispatch(DeviceEvents::Done));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_described.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL(Device::Off, sm_described.getCurrentState());
+  TEST_ASSERT_EQUAL_STRING("IiBbIi", device_log);
+
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_described.dispatch(DeviceEvents::Power));
+  TEST_ASSERT_EQUAL_STRING("OI", device_log);
+
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_described.dispatch(DeviceEvents::Work));
+  TEST_ASSERT_EQUAL_STRING("iB", device_log);
+
+  // Fail is declared on On: Busy is exited first, then On itself
+  clearDeviceLog();
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_described.dispatch(DeviceEvents::Fail));
+  TEST_ASSERT_EQUAL(Device::Fault, hsm_described.getCurrentState());
+  TEST_ASSERT_EQUAL_STRING("bo", device_log);
+}
+
+// Test 20: verify the first passing guard wins and a rejected action is never called
+template <typename Machine>
+void checkGuards(Machine& machine) {
+  valve_pressure = 0;
+  valve_closings = 0;
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(Valve::Open, machine.getCurrentState());
+
+  valve_pressure = 20;
+  TEST_ASSERT_EQUAL(TranResult::NoChange, machine.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(Valve::Open, machine.getCurrentState());
+  TEST_ASSERT_EQUAL(0, valve_closings);
+
+  valve_pressure = 0;
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(Valve::Closed, machine.getCurrentState());
+  TEST_ASSERT_EQUAL(1, valve_closings);
+
+  valve_pressure = 20;
+  TEST_ASSERT_EQUAL(TranResult::Change, machine.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(Valve::Locked, machine.getCurrentState());
+}
+
+void testGuards() {
+  checkGuards(sm_valve);
+  checkGuards(ism_valve);
+  checkGuards(pm_valve);
+  checkGuards(ssm_valve);
+  checkGuards(bsm_valve);
+}
+
+// Test 21: verify the monitor counts hits per transition, misses per pair and times hooks
+void testMonitor() {
+  valve_pressure = 0;
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_monitored.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_monitored.dispatch(ValveEvents::Toggle));
+
+  valve_pressure = 20;
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_monitored.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(TranResult::NotFound, sm_monitored.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(TranResult::NotFound, sm_monitored.dispatch(ValveEvents::Toggle));
+
+  const auto& stats = sm_monitored.getMonitor().getStats();
+  TEST_ASSERT_EQUAL(1, stats.transitions[0].hits);
+  TEST_ASSERT_EQUAL(1, stats.transitions[1].hits);
+  TEST_ASSERT_EQUAL(1, stats.transitions[2].hits);
+  TEST_ASSERT_EQUAL(2, stats.not_found[static_cast<size_t>(Valve::Locked)][0]);
+
+  const HookTiming& close = stats.transitions[2].hooks[static_cast<size_t>(HookStage::Transition)];
+  TEST_ASSERT_EQUAL(1, close.calls);
+  TEST_ASSERT_EQUAL(close.max, close.total);
+  TEST_ASSERT_EQUAL(0, stats.transitions[0].hooks[0].calls);
+
+  sm_monitored.getMonitor().reset();
+  TEST_ASSERT_EQUAL(0, stats.transitions[2].hits);
+  TEST_ASSERT_EQUAL(0, stats.not_found[static_cast<size_t>(Valve::Locked)][0]);
+}
+
+// Test 22: verify the trace keeps the last records in order and dumps them as a packed blob
+void testTrace() {
+  valve_pressure = 0;
+  for (size_t i = 0; i < 3; i++)
+    sm_traced.dispatch(ValveEvents::Toggle);
+
+  valve_pressure = 20;
+  sm_traced.dispatch(ValveEvents::Toggle);
+  sm_traced.dispatch(ValveEvents::Toggle);
+
+  // Closed -> Open -> Closed -> Open, then NoChange twice; the first record was overwritten
+  const auto& trace = sm_traced.getMonitor();
+  TEST_ASSERT_EQUAL(4, trace.size());
+  TEST_ASSERT_EQUAL(static_cast<uint16_t>(Valve::Open), trace[0].from);
+  TEST_ASSERT_EQUAL(static_cast<uint16_t>(Valve::Closed), trace[0].to);
+  TEST_ASSERT_EQUAL(static_cast<uint8_t>(TranResult::Change), trace[1].result);
+  TEST_ASSERT_EQUAL(static_cast<uint8_t>(TranResult::NoChange), trace[3].result);
+  TEST_ASSERT_EQUAL(static_cast<uint16_t>(Valve::Open), trace[3].to);
+
+  uint8_t blob[TraceMonitor<4>::kMaxDumpSize];
+  TEST_ASSERT_EQUAL(0, trace.dump(blob, sizeof(blob) - 1));
+  TEST_ASSERT_EQUAL(sizeof(blob), trace.dump(blob, sizeof(blob)));
+  TEST_ASSERT_EQUAL('S', blob[0]);
+  TEST_ASSERT_EQUAL(1, blob[3]);
+  TEST_ASSERT_EQUAL(4, blob[4] | (blob[5] << 8));
+  TEST_ASSERT_EQUAL(12, blob[6] | (blob[7] << 8));
+  TEST_ASSERT_EQUAL(static_cast<uint8_t>(Valve::Open), blob[8 + 4]);
+  TEST_ASSERT_EQUAL(static_cast<uint8_t>(TranResult::NoChange), blob[8 + 3 * 12 + 10]);
+
+  sm_traced.getMonitor().clear();
+  TEST_ASSERT_EQUAL(0, trace.size());
+}
+
+// Test 23: verify hooks get the typed context and getContext() returns it with its type
+void testTypedContext() {
+  TEST_ASSERT_EQUAL(TranResult::Change, ism_motor.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(100, valve_motor.speed);
+  TEST_ASSERT_EQUAL(TranResult::Change, ism_motor.dispatch(ValveEvents::Toggle));
+  TEST_ASSERT_EQUAL(0, valve_motor.speed);
+
+  Motor* const motor = ism_motor.getContext(Valve::Open, ValveEvents::Toggle, Valve::Closed);
+  TEST_ASSERT_EQUAL_PTR(&valve_motor, motor);
+}
+
+// Test 24: verify entering a timed state arms its timeout and leaving it cancels it
+void testTimedTransitions() {
+  TEST_ASSERT_EQUAL(TranResult::Change, ism_net_timer.dispatch(NetEvents::Connect));
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_net_timer.dispatch(NetEvents::Connect));
+  TEST_ASSERT_EQUAL(2, net_wheel.armedCount());
+
+  TEST_ASSERT_EQUAL(0, net_wheel.tick(4999));
+  TEST_ASSERT_EQUAL(Net::Connecting, ism_net.getCurrentState());
+  TEST_ASSERT_EQUAL(2, net_wheel.tick(5000));
+  TEST_ASSERT_EQUAL(Net::Idle, ism_net.getCurrentState());
+  TEST_ASSERT_EQUAL(Net::Idle, hsm_net.getCurrentState());
+  TEST_ASSERT_FALSE(ism_net_timer.isArmed());
+
+  // Connected before the timeout: the flat machine has no timer in Up, the nested one inherits it
+  ism_net_timer.dispatch(NetEvents::Connect);
+  hsm_net_timer.dispatch(NetEvents::Connect);
+  net_wheel.tick(6000);
+  TEST_ASSERT_EQUAL(TranResult::Change, ism_net_timer.dispatch(NetEvents::Connected));
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_net_timer.dispatch(NetEvents::Connected));
+  TEST_ASSERT_FALSE(ism_net_timer.isArmed());
+  TEST_ASSERT_TRUE(hsm_net_timer.isArmed());
+
+  // Moving between children of Online does not leave it, so its keepalive keeps running
+  net_wheel.tick(10000);
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_net_timer.dispatch(NetEvents::Transfer));
+  net_wheel.tick(15000);
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_net_timer.dispatch(NetEvents::Transfer));
+  TEST_ASSERT_EQUAL(Net::Up, hsm_net.getCurrentState());
+
+  TEST_ASSERT_EQUAL(0, net_wheel.tick(25999));
+  TEST_ASSERT_EQUAL(1, net_wheel.tick(26000));
+  TEST_ASSERT_EQUAL(Net::Up, ism_net.getCurrentState());
+  TEST_ASSERT_EQUAL(Net::Idle, hsm_net.getCurrentState());
+  TEST_ASSERT_EQUAL(0, net_wheel.armedCount());
+}
+
+// Test 25: verify a snapshot restores the state silently unless asked, and keeps pending timeouts
+void testSnapshotRestore() {
+  using Snapshot = HierarchicalStateMachine<Device, DeviceEvents, 5, 5>::Snapshot;
+
+  const Snapshot saved = hsm_described.snapshot();
+  TEST_ASSERT_EQUAL(Device::Fault, saved.state);
+
+  clearDeviceLog();
+  hsm_described.resetState();
+  TEST_ASSERT_TRUE(hsm_described.restore(saved));
+  TEST_ASSERT_EQUAL(Device::Fault, hsm_described.getCurrentState());
+  TEST_ASSERT_EQUAL_STRING("", device_log);
+
+  // Entering Busy runs the hooks of On, then of Busy
+  Snapshot busy = {Device::Busy, static_cast<uint8_t>(~static_cast<uint8_t>(Device::Busy))};
+  TEST_ASSERT_TRUE(hsm_described.restore(busy, true));
+  TEST_ASSERT_EQUAL(Device::Busy, hsm_described.getCurrentState());
+  TEST_ASSERT_EQUAL_STRING("OB", device_log);
+
+  // Zeroed memory and unknown states are rejected
+  const Snapshot zeroed = {Device::Off, 0};
+  busy.state            = static_cast<Device>(7);
+  busy.seal             = static_cast<uint8_t>(~7);
+  TEST_ASSERT_FALSE(hsm_described.restore(zeroed));
+  TEST_ASSERT_FALSE(hsm_described.restore(busy));
+  TEST_ASSERT_EQUAL(Device::Busy, hsm_described.getCurrentState());
+
+  // The timeout resumes with the ticks it had left
+  TEST_ASSERT_EQUAL(TranResult::Change, hsm_net_timer.dispatch(NetEvents::Connect));
+  net_wheel.tick(27000);
+
+  const auto timed = hsm_net_timer.snapshot();
+  TEST_ASSERT_EQUAL(4000, timed.remaining);
+
+  hsm_net_timer.stop();
+  hsm_net.resetState();
+  TEST_ASSERT_TRUE(hsm_net_timer.restore(timed));
+  TEST_ASSERT_EQUAL(Net::Connecting, hsm_net.getCurrentState());
+  TEST_ASSERT_EQUAL(0, net_wheel.tick(30999));
+  TEST_ASSERT_EQUAL(1, net_wheel.tick(31000));
+  TEST_ASSERT_EQUAL(Net::Idle, hsm_net.getCurrentState());
+
+  Links states[40];
+  for (auto& state : states)
+    state = Links::Up;
+  TEST_ASSERT_TRUE(links.restoreStates(states));
+  TEST_ASSERT_EQUAL(Links::Up, links.getCurrentState(links.size() - 1));
+  links.resetAll();
+}
+
+// Test 26: verify table validation reports the first problem of each table
+void testTableValidation() {
+  TEST_ASSERT_EQUAL(TableIssue::None, sm_modes.validate().issue);
+  TEST_ASSERT_EQUAL(TableIssue::None, ism_valve.validate().issue);
+  TEST_ASSERT_EQUAL(TableIssue::None, hsm.validate().issue);
+  TEST_ASSERT_EQUAL(TableIssue::None, hsm_net.validate().issue);
+
+  // Online is only ever entered as the parent of Up
+  const TableCheck net = ism_net.validate();
+  TEST_ASSERT_EQUAL(TableIssue::DeadState, net.issue);
+  TEST_ASSERT_EQUAL(3, net.entry);
+
+  const TableCheck flawed = sm_flawed.validate();
+  TEST_ASSERT_EQUAL(TableIssue::Shadowed, flawed.issue);
+  TEST_ASSERT_EQUAL(3, flawed.entry);
+
+  StateMachine<Modes, ModeEvents> duplicated(Modes::Idle,
+    {
+      {Modes::Idle, ModeEvents::Start, Modes::Run, nullptr, nullptr, nullptr, nullptr},
+      {Modes::Idle, ModeEvents::Start, Modes::Error, nullptr, nullptr, nullptr, nullptr},
+    });
+  TEST_ASSERT_EQUAL(TableIssue::Duplicate, duplicated.validate().issue);
+  TEST_ASSERT_EQUAL(1, duplicated.validate().entry);
+
+  IndexedStateMachine<Modes, ModeEvents, 2, 4> ranged(Modes::Idle, FLAWED_TRANSITIONS);
+  TEST_ASSERT_EQUAL(TableIssue::OutOfRange, ranged.validate().issue);
+
+  // Transitions the storage or the index could not hold are reported from the first one dropped
+  StateMachine<Modes, ModeEvents, LinearIndex, std::function, InlineStorage<3>> cramped(Modes::Idle,
+    FLAWED_TRANSITIONS);
+  TEST_ASSERT_EQUAL(TableIssue::Overflow, cramped.validate().issue);
+  TEST_ASSERT_EQUAL(3, cramped.validate().entry);
+
+  StateMachine<Modes, ModeEvents, PackedIndex<3, 4, 2>> packed(Modes::Idle, FLAWED_TRANSITIONS);
+  TEST_ASSERT_EQUAL(TableIssue::Overflow, packed.validate().issue);
+  TEST_ASSERT_EQUAL(2, packed.validate().entry);
+}
+
+// Test 27: verify each event only reaches the regions that handle it
+void testParallelRegions() {
+  TEST_ASSERT_EQUAL(3, system_regions.getRoutes(SystemEvents::Sleep));
+  TEST_ASSERT_EQUAL(1, system_regions.getRoutes(SystemEvents::Wake));
+  TEST_ASSERT_EQUAL(2, system_regions.getRoutes(SystemEvents::Join));
+  TEST_ASSERT_EQUAL(0, system_regions.getRoutes(SystemEvents::Tick));
+
+  ResultMask results = system_regions.dispatch(SystemEvents::Join);
+  TEST_ASSERT_TRUE(results.has(TranResult::Change));
+  TEST_ASSERT_FALSE(results.has(TranResult::NotFound));
+  TEST_ASSERT_EQUAL(Radio::Joining, radio.getCurrentState());
+
+  results = system_regions.dispatch(SystemEvents::Tick);
+  TEST_ASSERT_TRUE(results.has(TranResult::NotFound));
+
+  // Wake is not offered to the radio, which would have reported NotFound
+  system_regions.dispatch(SystemEvents::Sleep);
+  TEST_ASSERT_EQUAL(Power::Asleep, power.getCurrentState());
+  TEST_ASSERT_EQUAL(Radio::Off, radio.getCurrentState());
+
+  results = system_regions.dispatch(SystemEvents::Wake);
+  TEST_ASSERT_TRUE(results.has(TranResult::Change));
+  TEST_ASSERT_FALSE(results.has(TranResult::NotFound));
+  TEST_ASSERT_EQUAL(Power::Awake, power.getCurrentState());
+}
+
+// Test 28: verify workers drain their own queues first, in batches, and steal pending ones
+void testExecutor() {
+  TEST_ASSERT_TRUE(executor.add(power_queue, 0));
+  TEST_ASSERT_TRUE(executor.add(radio_queue, 0));
+  TEST_ASSERT_FALSE(executor.add(radio_queue, 1));
+
+  power_queue.post(SystemEvents::Sleep);
+  power_queue.post(SystemEvents::Wake);
+  radio_queue.post(SystemEvents::Join);
+
+  // Worker 1 owns nothing, so it takes one batch of the first pending queue
+  TEST_ASSERT_EQUAL(1, executor.runOnce(1));
+  TEST_ASSERT_EQUAL(Power::Asleep, power.getCurrentState());
+  TEST_ASSERT_EQUAL(1, executor.getStolen(0));
+
+  TEST_ASSERT_EQUAL(2, executor.runOnce(0));
+  TEST_ASSERT_EQUAL(Power::Awake, power.getCurrentState());
+  TEST_ASSERT_EQUAL(Radio::Joining, radio.getCurrentState());
+  TEST_ASSERT_EQUAL(0, executor.getStolen(1));
+
+  TEST_ASSERT_EQUAL(0, executor.runOnce(0));
+  TEST_ASSERT_EQUAL(0, executor.runOnce(1));
+}
+
+#if defined(__cpp_impl_coroutine)
+// Test 29: verify a suspended hook holds the transition and queues the events meanwhile
+void testAsyncHooks() {
+  TEST_ASSERT_EQUAL(TranResult::Pending, sensor.dispatch(SensorEvents::Read));
+  TEST_ASSERT_TRUE(sensor.isTransitioning());
+  TEST_ASSERT_EQUAL(Sensor::Idle, sensor.getCurrentState());
+  TEST_ASSERT_EQUAL(TranResult::Deferred, sensor.dispatch(SensorEvents::Clear));
+  TEST_ASSERT_EQUAL(TranResult::Deferred, sensor.dispatch(SensorEvents::Read));
+  TEST_ASSERT_FALSE(sensor.resetState());
+
+  // Completes the read, then Clear runs and the second Read finds the signal already set
+  i2c_done.set();
+  TEST_ASSERT_FALSE(sensor.isTransitioning());
+  TEST_ASSERT_EQUAL(Sensor::Ready, sensor.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::Change, sensor.dispatch(SensorEvents::Clear));
+  TEST_ASSERT_EQUAL(TranResult::Change, sensor.dispatch(SensorEvents::Read));
+  TEST_ASSERT_EQUAL(Sensor::Ready, sensor.getCurrentState());
+  TEST_ASSERT_TRUE(sensor.resetState());
+  TEST_ASSERT_EQUAL(Sensor::Idle, sensor.getCurrentState());
+
+  // A dispatch from the enter hook run by the completion is deferred until the commit is done
+  TEST_ASSERT_EQUAL(TranResult::Pending, probe.dispatch(ProbeEvents::Sample));
+  adc_done.set();
+  TEST_ASSERT_EQUAL(TranResult::Deferred, probe_store);
+  TEST_ASSERT_EQUAL(Probe::Stored, probe.getCurrentState());
+}
+#endif
+
+// Test 30: verify payloads are forwarded by reference and checked against their type
+void testPayloads() {
+  const Frame frame = {3, {1, 2, 3}};
+
+  TEST_ASSERT_EQUAL(TranResult::NoChange, parser.dispatch(ParserEvents::Frame));
+  TEST_ASSERT_NULL(parsed_frame);
+  TEST_ASSERT_EQUAL(TranResult::NoChange, parser.dispatch(ParserEvents::Frame, 3));
+  TEST_ASSERT_NULL(parsed_frame);
+
+  TEST_ASSERT_EQUAL(TranResult::Change, parser.dispatch(ParserEvents::Frame, frame));
+  TEST_ASSERT_TRUE(parsed_frame == &frame);
+  TEST_ASSERT_NULL(parser.getPayload<Frame>());
+
+  // Queued frames are copied once into the queue and handed over from there
+  TEST_ASSERT_TRUE(frame_queue.post(ParserEvents::Reset));
+  TEST_ASSERT_TRUE(frame_queue.post(ParserEvents::Frame, frame));
+  TEST_ASSERT_EQUAL(2, frame_queue.processPending());
+  TEST_ASSERT_EQUAL(Parser::Parsed, parser.getCurrentState());
+  TEST_ASSERT_TRUE(parsed_frame != &frame);
+  TEST_ASSERT_EQUAL(3, parsed_frame->length);
+  TEST_ASSERT_EQUAL(3, parsed_frame->data[2]);
+
+  // Deferred payloads are copied into the run-to-completion queue, if they fit there
+  TEST_ASSERT_EQUAL(TranResult::Change, relay.dispatch(RelayEvents::Arm));
+  TEST_ASSERT_EQUAL(TranResult::Deferred, relay_sent);
+  TEST_ASSERT_EQUAL(TranResult::Overflow, relay_burst);
+  TEST_ASSERT_EQUAL(Relay::Sent, relay.getCurrentState());
+  TEST_ASSERT_EQUAL(42, relay_value);
+}
+
+// Test 31: verify tables export as diagrams, with hook presence and the hot transitions in bold
+void testGraphExport() {
+  char text[1024];
+
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_modes_graph.dispatch(ModeEvents::Start));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_modes_graph.dispatch(ModeEvents::Stop));
+  TEST_ASSERT_EQUAL(TranResult::Change, sm_modes_graph.dispatch(ModeEvents::Start));
+
+  GraphExporter<Modes, ModeEvents> plantuml(GraphFormat::PlantUml, modeName, modeEventName);
+  plantuml.setHits(sm_modes_graph.getMonitor().getStats().transitions);
+  plantuml.write(sm_modes_graph.getDefinition(), text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("@startuml\n"
+                           "state \"*\" as AnyState\n"
+                           "[*] --> Idle\n"
+                           "AnyState --> Error : Fault (hits: 0)\n"
+                           "Run --> Run : * / transition (hits: 0)\n"
+                           "Idle -[bold]-> Run : Start (hits: 2)\n"
+                           "Run -[bold]-> Idle : Stop (hits: 1)\n"
+                           "Error --> Idle : Clear (hits: 0)\n"
+                           "@enduml\n",
+    text);
+
+  // Without names, states and events are written by value
+  GraphExporter<Valve, ValveEvents> dot(GraphFormat::Dot);
+  dot.write(Valve::Closed, valve_table, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("digraph StateForge {\n"
+                           "  __initial [shape=point];\n"
+                           "  __initial -> \"S0\";\n"
+                           "  \"S0\" -> \"S1\" [label=\"E0 [guard]\"];\n"
+                           "  \"S0\" -> \"S2\" [label=\"E0 [guard]\"];\n"
+                           "  \"S1\" -> \"S0\" [label=\"E0 [guard] / transition\"];\n"
+                           "}\n",
+    text);
+
+  // Like snprintf, the full length is returned and the text is cut to the buffer
+  GraphExporter<Modes, ModeEvents> json(GraphFormat::Json, modeName, modeEventName);
+  const size_t length = json.write(sm_modes_graph.getDefinition(), nullptr, 0);
+  TEST_ASSERT_EQUAL(length, json.write(sm_modes_graph.getDefinition(), text, sizeof(text)));
+  TEST_ASSERT_EQUAL(length, std::strlen(text));
+  const char* run_any = "{\"from\":\"Run\",\"event\":\"*\",\"to\":\"Run\",\"guard\":false,"
+                        "\"on_enter\":false,\"on_transition\":true,";
+  TEST_ASSERT_NOT_NULL(std::strstr(text, run_any));
+
+  TEST_ASSERT_EQUAL(length, json.write(sm_modes_graph.getDefinition(), text, 12));
+  TEST_ASSERT_EQUAL_STRING("{\"initial\":", text);
+}
+
+// Test 32: verify a recorded trace replays, chained events included, and mismatches are found
+void testTraceReplay() {
+  const ModeEvents recorded[] = {ModeEvents::Start, ModeEvents::Fault, ModeEvents::Stop,
+    ModeEvents::Start};
+  for (ModeEvents event : recorded)
+    replay_recorder.dispatch(event);
+
+  // The Clear deferred by the hook of Fault is recorded right after it
+  const auto& trace = replay_recorder.getMonitor();
+  TEST_ASSERT_EQUAL(5, trace.size());
+  TEST_ASSERT_EQUAL(static_cast<uint16_t>(ModeEvents::Clear), trace[2].event);
+
+  uint8_t blob[TraceMonitor<16>::kMaxDumpSize];
+  const size_t size = trace.dump(blob, sizeof(blob));
+
+  ReplayReport report;
+  replay_target = &replay_player;
+  TEST_ASSERT_EQUAL(ReplayResult::Match,
+    replayTrace(replay_player, replay_player.getMonitor(), blob, size, report));
+  TEST_ASSERT_EQUAL(5, report.records);
+  TEST_ASSERT_EQUAL(5, report.matched);
+  TEST_ASSERT_EQUAL(4, report.dispatches);
+  TEST_ASSERT_EQUAL(Modes::Run, replay_player.getCurrentState());
+
+  // The last Start recorded as NoChange instead of Change
+  blob[TraceMonitor<16>::kHeaderSize + 4 * TraceMonitor<16>::kRecordSize + 10] =
+    static_cast<uint8_t>(TranResult::NoChange);
+  replay_player.resetState();
+  TEST_ASSERT_EQUAL(ReplayResult::Mismatch,
+    replayTrace(replay_player, replay_player.getMonitor(), blob, size, report));
+  TEST_ASSERT_EQUAL(4, report.matched);
+
+  replay_player.resetState();
+  TEST_ASSERT_EQUAL(ReplayResult::Invalid,
+    replayTrace(replay_player, replay_player.getMonitor(), blob, size - 1, report));
+  blob[0] = 'X';
+  TEST_ASSERT_EQUAL(ReplayResult::Invalid,
+    replayTrace(replay_player, replay_player.getMonitor(), blob, size, report));
+}
+
+// Test 33: verify images load in place, report unknown hook IDs, and are rejected when corrupt
+void testBinaryTables() {
+  TEST_ASSERT_EQUAL(ValveImage::imageSize(3), valve_image_size);
+  TEST_ASSERT_TRUE(bsm_valve.getDefinition().isLoaded());
+  TEST_ASSERT_EQUAL(TableIssue::None, bsm_valve.validate().issue);
+  TEST_ASSERT_EQUAL(3, bsm_valve.getDefinition().getTransitions().size());
+  TEST_ASSERT_TRUE(bsm_valve.getDefinition().getTransitions()[2].on_transition == onValveClose);
+
+  // Read as is: the image is not copied, while the registry is and can be a temporary
+  uint8_t image[ValveImage::imageSize(3)];
+  std::memcpy(image, valve_image, sizeof(image));
+  BinaryStateMachine<Valve, ValveEvents> machine(image, sizeof(image),
+    {nullptr, 0, valve_transition_hooks, 1, nullptr, 0, valve_guards, 2, nullptr, 0});
+
+  image[ValveImage::kHeaderSize + 2 * ValveImage::kEntrySize + 7] = 1;
+  const TableCheck check = machine.validate();
+  TEST_ASSERT_EQUAL(TableIssue::OutOfRange, check.issue);
+  TEST_ASSERT_EQUAL(2, check.entry);
+
+  image[3] = ValveImage::kVersion + 1;
+  BinaryStateMachine<Valve, ValveEvents> newer(image, sizeof(image), valve_hooks);
+  TEST_ASSERT_FALSE(newer.getDefinition().isLoaded());
+  TEST_ASSERT_EQUAL(TableIssue::OutOfRange, newer.validate().issue);
+  TEST_ASSERT_EQUAL(TranResult::NotFound, newer.dispatch(ValveEvents::Toggle));
+
+  BinaryStateMachine<Valve, ValveEvents> truncated(valve_image, valve_image_size - 1, valve_hooks);
+  TEST_ASSERT_FALSE(truncated.getDefinition().isLoaded());
+
+  // As is a partition that was not found
+  BinaryStateMachine<Valve, ValveEvents> missing(nullptr, 0, valve_hooks);
+  TEST_ASSERT_FALSE(missing.getDefinition().isLoaded());
+  TEST_ASSERT_EQUAL(TranResult::NotFound, missing.dispatch(ValveEvents::Toggle));
+}
+
+// Test 34: verify history pseudo-states resume the last child or innermost state, until a reset
+void testHistoryStates() {
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Play));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Next));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Next));
+  TEST_ASSERT_EQUAL(Player::Chorus, player.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Pause));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::ResumeDeep));
+  TEST_ASSERT_EQUAL(Player::Chorus, player.getCurrentState());
+
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Pause));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Resume));
+  TEST_ASSERT_EQUAL(Player::Track2, player.getCurrentState());
+  TEST_ASSERT_TRUE(player.isInState(Player::Playing));
+
+  // The machine is never in a pseudo-state, and a reset forgets the history
+  const uint8_t seal = static_cast<uint8_t>(~static_cast<size_t>(Player::Deep));
+  TEST_ASSERT_FALSE(player.restore({Player::Deep, seal}));
+
+  player.resetState();
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::ResumeDeep));
+  TEST_ASSERT_EQUAL(Player::Playing, player.getCurrentState());
+  TEST_ASSERT_EQUAL(TableIssue::None, player.validate().issue);
+
+  // Nor does a restore, as the history is not part of the snapshot
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Pause));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Play));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Pause));
+  TEST_ASSERT_TRUE(player.restore(player.snapshot()));
+  TEST_ASSERT_EQUAL(TranResult::Change, player.dispatch(PlayerEvents::Resume));
+  TEST_ASSERT_EQUAL(Player::Playing, player.getCurrentState());
+}
+
+// Test 35: verify coalesced and superseded posts are not dispatched and deferred ones wait
+void testEventPolicies() {
+  uplink_queue.setPolicy(UplinkEvents::Connect, EventPolicy::Coalesce);
+  uplink_queue.setPolicy(UplinkEvents::Sample, EventPolicy::Latest);
+  uplink_queue.setPolicy(UplinkEvents::Send, EventPolicy::Defer);
+  TEST_ASSERT_FALSE(uplink_queue.accepts(Uplink::Down, UplinkEvents::Send));
+  TEST_ASSERT_TRUE(uplink_queue.accepts(Uplink::Down, UplinkEvents::Sample));
+
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Send));
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Send));
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Sample, 1));
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Sample, 2));
+  for (size_t i = 0; i < 3; i++)
+    TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Connect));
+
+  // Both Sends are held until Connect brings the link up, then dispatched right after it
+  TEST_ASSERT_EQUAL(5, uplink_queue.processPending());
+  TEST_ASSERT_EQUAL(Uplink::Up, uplink.getCurrentState());
+  TEST_ASSERT_EQUAL(1, link_connects);
+  TEST_ASSERT_EQUAL(1, link_samples);
+  TEST_ASSERT_EQUAL(2, link_level);
+  TEST_ASSERT_EQUAL(2, link_sends);
+  TEST_ASSERT_EQUAL(0, uplink_queue.getHeld());
+
+  // Once dispatched, Connect is no longer pending and a new post is queued again
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Drop));
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Drop));
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Connect));
+  TEST_ASSERT_EQUAL(3, uplink_queue.processPending());
+  TEST_ASSERT_EQUAL(2, link_connects);
+
+  // Nor when its post found the queue full, so a later post does not coalesce into nothing
+  for (size_t i = 0; i < 8; i++)
+    TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Drop));
+  TEST_ASSERT_FALSE(uplink_queue.post(UplinkEvents::Connect));
+  TEST_ASSERT_FALSE(uplink_queue.post(UplinkEvents::Connect));
+  TEST_ASSERT_EQUAL(8, uplink_queue.processPending());
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Connect));
+  TEST_ASSERT_EQUAL(1, uplink_queue.processPending());
+  TEST_ASSERT_EQUAL(3, link_connects);
+
+  // The deferred list holds Capacity events and drops the ones past it
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Drop));
+  TEST_ASSERT_EQUAL(1, uplink_queue.processPending());
+  for (size_t i = 0; i < 9; i++) {
+    TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Send));
+    uplink_queue.processPending();
+  }
+
+  TEST_ASSERT_EQUAL(8, uplink_queue.getHeld());
+  TEST_ASSERT_EQUAL(1, uplink_queue.getDropped());
+  TEST_ASSERT_TRUE(uplink_queue.post(UplinkEvents::Connect));
+  TEST_ASSERT_EQUAL(1, uplink_queue.processPending());
+  TEST_ASSERT_EQUAL(10, link_sends);
+  TEST_ASSERT_TRUE(uplink_queue.isEmpty());
+}
 /* ---------------------------------------------------------------------------------------------- */
 
 void setup() {
@@ -233,6 +1686,36 @@ void setup() {
   RUN_TEST(testStateReset);
   RUN_TEST(testStateContexts);
   RUN_TEST(testContextType);
+  RUN_TEST(testIndexedTransitions);
+  RUN_TEST(testStaticTransitions);
+  RUN_TEST(testDelegateHooks);
+  RUN_TEST(testFixedStorage);
+  RUN_TEST(testEventQueue);
+  RUN_TEST(testRunToCompletion);
+  RUN_TEST(testDispatchAll);
+  RUN_TEST(testInstancePool);
+  RUN_TEST(testBroadcast);
+  RUN_TEST(testHierarchicalStates);
+  RUN_TEST(testWildcards);
+  RUN_TEST(testStateDescriptors);
+  RUN_TEST(testGuards);
+  RUN_TEST(testMonitor);
+  RUN_TEST(testTrace);
+  RUN_TEST(testTypedContext);
+  RUN_TEST(testTimedTransitions);
+  RUN_TEST(testSnapshotRestore);
+  RUN_TEST(testTableValidation);
+  RUN_TEST(testParallelRegions);
+  RUN_TEST(testExecutor);
+#if defined(__cpp_impl_coroutine)
+  RUN_TEST(testAsyncHooks);
+#endif
+  RUN_TEST(testPayloads);
+  RUN_TEST(testGraphExport);
+  RUN_TEST(testTraceReplay);
+  RUN_TEST(testBinaryTables);
+  RUN_TEST(testHistoryStates);
+  RUN_TEST(testEventPolicies);
 
   UNITY_END();
 }